@@ -0,0 +1,62 @@
+#include "adjacency.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+void build_vertex_adjacency(const IndexedMesh &mesh, VertexAdjacency &adjacency_, unsigned threads)
+{
+    size_t n = mesh.vertices.size();
+    size_t triangles = mesh.triangle_count();
+    const uint32_t *idx = mesh.indices.data();
+
+    // Step 1. every corner has two edges in its triangle; interior edges are
+    // seen from both of their triangles and deduplicated in step 3
+    vector<atomic<uint32_t>> cursor(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) cursor[v].store(0, memory_order_relaxed);
+    }, threads);
+    parallel_for(triangles * 3, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i) cursor[idx[i]].fetch_add(2, memory_order_relaxed);
+    }, threads);
+
+    vector<uint32_t> start(n + 1, 0);
+    for (size_t v = 0; v < n; ++v) {
+        start[v + 1] = start[v] + cursor[v].load(memory_order_relaxed);
+        cursor[v].store(start[v], memory_order_relaxed);
+    }
+
+    // Step 2. scatter
+    vector<uint32_t> all(start[n]);
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned) {
+        for (size_t t = begin; t < end; ++t) {
+            const uint32_t *f = idx + t * 3;
+            for (int c = 0; c < 3; ++c) {
+                uint32_t slot = cursor[f[c]].fetch_add(2, memory_order_relaxed);
+                all[slot] = f[(c + 1) % 3];
+                all[slot + 1] = f[(c + 2) % 3];
+            }
+        }
+    }, threads);
+
+    // Step 3. sort and deduplicate every row, then close the gaps
+    vector<uint32_t> &count = adjacency_.start;
+    count.assign(n + 1, 0);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) {
+            auto first = all.begin() + start[v], last = all.begin() + start[v + 1];
+            sort(first, last);
+            count[v + 1] = uint32_t(unique(first, last) - first);
+        }
+    }, threads);
+    for (size_t v = 0; v < n; ++v) count[v + 1] += count[v];
+
+    adjacency_.neighbors.resize(count[n]);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v)
+            copy(all.begin() + start[v], all.begin() + start[v] + (count[v + 1] - count[v]),
+                 adjacency_.neighbors.begin() + count[v]);
+    }, threads);
+}
@@ -0,0 +1,22 @@
+#ifndef DA_SEG_ADJACENCY_H
+#define DA_SEG_ADJACENCY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "mesh.h"
+
+// Vertex neighbours along triangle edges, compressed rows: the neighbours of
+// vertex v are neighbors[start[v]] .. neighbors[start[v + 1] - 1], sorted and
+// without duplicates.
+struct VertexAdjacency {
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> neighbors;
+
+    size_t vertex_count() const { return start.empty() ? 0 : start.size() - 1; }
+};
+
+// Built in parallel in O(V + E)
+void build_vertex_adjacency(const IndexedMesh &mesh, VertexAdjacency &adjacency_, unsigned threads = 0);
+
+#endif // DA_SEG_ADJACENCY_H
@@ -0,0 +1,430 @@
+#include "decimate.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+const uint32_t kNoVertex = UINT32_MAX;
+const uint64_t kNoKey = UINT64_MAX;
+
+// Edges competing in a pass, as a multiple of the collapses still needed
+const size_t kWiden = 4;
+// Selection rounds per pass
+const int kRounds = 8;
+// Smallest cosine between a face normal before and after a collapse
+const double kMinNormalCos = 0.2;
+// Smallest triangle quality a collapse may create, see face_quality
+const double kMinQuality = 0.05;
+// Scales twice the area over the sum of squared edge lengths to 1 for an equilateral triangle
+const double kEquilateral = 2 * sqrt(3.0);
+
+// Symmetric 4x4 error quadric: xx xy xz xw yy yz yw zz zw ww
+struct Quadric {
+  double q[10] = {};
+
+  void add_plane(double a, double b, double c, double d, double w)
+  {
+    q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+    q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+    q[7] += w * c * c; q[8] += w * c * d;
+    q[9] += w * d * d;
+  }
+
+  Quadric &operator+=(const Quadric &o)
+  {
+    for (int i = 0; i < 10; ++i) q[i] += o.q[i];
+    return *this;
+  }
+
+  double error(double x, double y, double z) const
+  {
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+         + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+         + q[7] * z * z + 2 * q[8] * z
+         + q[9];
+  }
+
+  // Position minimizing the error, false if the system is near singular
+  bool optimum(double &x, double &y, double &z) const
+  {
+    double a = q[0], b = q[1], c = q[2], d = q[4], e = q[5], f = q[7];
+    double det = a * (d * f - e * e) - b * (b * f - e * c) + c * (b * e - d * c);
+    double scale = fabs(a) + fabs(d) + fabs(f);
+    if (fabs(det) <= 1e-12 * scale * scale * scale) return false;
+    double r0 = -q[3], r1 = -q[6], r2 = -q[8];
+    x = (r0 * (d * f - e * e) - b * (r1 * f - e * r2) + c * (r1 * e - d * r2)) / det;
+    y = (a * (r1 * f - e * r2) - r0 * (b * f - e * c) + c * (b * r2 - r1 * c)) / det;
+    z = (a * (d * r2 - r1 * e) - b * (b * r2 - r1 * c) + r0 * (b * e - d * c)) / det;
+    return true;
+  }
+};
+
+struct Edge {
+  uint32_t keep;
+  uint32_t remove;
+  float x, y, z;   // position of keep after the collapse
+  uint64_t key;    // cost bits << 32 | edge index, unique and ordered by cost
+};
+
+// vertex -> incident faces, as CSR
+struct Adjacency {
+  vector<uint32_t> start;
+  vector<uint32_t> faces;
+
+  void build(size_t vertex_count, const vector<uint32_t> &indices)
+  {
+    start.assign(vertex_count + 1, 0);
+    for (uint32_t v : indices) ++start[v + 1];
+    for (size_t v = 0; v < vertex_count; ++v) start[v + 1] += start[v];
+    faces.resize(indices.size());
+    vector<uint32_t> fill(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) faces[fill[indices[i]]++] = uint32_t(i / 3);
+  }
+};
+
+// Neighbours of v with the number of faces shared with each, sorted by vertex
+void neighbours(const Adjacency &adj, const vector<uint32_t> &indices, uint32_t v,
+                vector<pair<uint32_t, uint32_t>> &out)
+{
+  static thread_local vector<uint32_t> raw;
+  raw.clear();
+  for (uint32_t k = adj.start[v]; k < adj.start[v + 1]; ++k) {
+    const uint32_t *f = &indices[size_t(adj.faces[k]) * 3];
+    for (int c = 0; c < 3; ++c)
+      if (f[c] != v) raw.push_back(f[c]);
+  }
+  sort(raw.begin(), raw.end());
+  out.clear();
+  for (uint32_t u : raw) {
+    if (!out.empty() && out.back().first == u) ++out.back().second;
+    else out.push_back({u, 1});
+  }
+}
+
+void face_normal(const Vertices &p, uint32_t a, uint32_t b, uint32_t c, double n[3])
+{
+  double ux = p.x[b] - p.x[a], uy = p.y[b] - p.y[a], uz = p.z[b] - p.z[a];
+  double wx = p.x[c] - p.x[a], wy = p.y[c] - p.y[a], wz = p.z[c] - p.z[a];
+  n[0] = uy * wz - uz * wy;
+  n[1] = uz * wx - ux * wz;
+  n[2] = ux * wy - uy * wx;
+}
+
+// 1 for an equilateral triangle, 0 for a degenerate one
+double face_quality(const Vertices &p, uint32_t a, uint32_t b, uint32_t c, const double n[3])
+{
+  double squares = 0;
+  const uint32_t corners[4] = {a, b, c, a};
+  for (int k = 0; k < 3; ++k) {
+    double dx = p.x[corners[k + 1]] - p.x[corners[k]];
+    double dy = p.y[corners[k + 1]] - p.y[corners[k]];
+    double dz = p.z[corners[k + 1]] - p.z[corners[k]];
+    squares += dx * dx + dy * dy + dz * dz;
+  }
+  return squares > 0 ? kEquilateral * sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) / squares : 0;
+}
+
+// Moving `moved` (which replaces `gone`) to (x, y, z) must not flip any face
+// around it that survives the collapse
+bool keeps_orientation(const Adjacency &adj, const vector<uint32_t> &indices, const Vertices &p,
+                       uint32_t moved, uint32_t gone, float x, float y, float z)
+{
+  for (uint32_t v : {moved, gone}) {
+    for (uint32_t k = adj.start[v]; k < adj.start[v + 1]; ++k) {
+      const uint32_t *f = &indices[size_t(adj.faces[k]) * 3];
+      bool has_moved = f[0] == moved || f[1] == moved || f[2] == moved;
+      bool has_gone = f[0] == gone || f[1] == gone || f[2] == gone;
+      if (has_moved && has_gone) continue; // collapses away
+
+      double before[3], after[3];
+      face_normal(p, f[0], f[1], f[2], before);
+
+      double px[3], py[3], pz[3];
+      for (int c = 0; c < 3; ++c) {
+        bool target = f[c] == v;
+        px[c] = target ? x : p.x[f[c]];
+        py[c] = target ? y : p.y[f[c]];
+        pz[c] = target ? z : p.z[f[c]];
+      }
+      double ux = px[1] - px[0], uy = py[1] - py[0], uz = pz[1] - pz[0];
+      double wx = px[2] - px[0], wy = py[2] - py[0], wz = pz[2] - pz[0];
+      after[0] = uy * wz - uz * wy;
+      after[1] = uz * wx - ux * wz;
+      after[2] = ux * wy - uy * wx;
+
+      // also rejects faces turning nearly edge-on, which become slivers or flip later
+      double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+      double lengths = sqrt((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                            (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+      if (dot <= kMinNormalCos * lengths) return false;
+
+      // and faces collapsing into slivers, unless the face already was one
+      double vx = wx - ux, vy = wy - uy, vz = wz - uz;
+      double squares = ux * ux + uy * uy + uz * uz + wx * wx + wy * wy + wz * wz + vx * vx + vy * vy + vz * vz;
+      double quality = kEquilateral * sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]) / squares;
+      if (quality < kMinQuality && quality < face_quality(p, f[0], f[1], f[2], before)) return false;
+    }
+  }
+  return true;
+}
+
+inline void atomic_min(atomic<uint64_t> &slot, uint64_t value)
+{
+  uint64_t current = slot.load(memory_order_relaxed);
+  while (value < current && !slot.compare_exchange_weak(current, value, memory_order_relaxed)) {
+  }
+}
+
+} // namespace
+
+void decimate(const IndexedMesh &mesh, size_t target_triangles, IndexedMesh &out_,
+              DecimateStats *stats_, unsigned threads)
+{
+    Vertices pos = mesh.vertices;
+    vector<uint32_t> indices = mesh.indices;
+    size_t nv = pos.size();
+    DecimateStats stats;
+    stats.input_triangles = indices.size() / 3;
+
+    Adjacency adj;
+    adj.build(nv, indices);
+
+    // Step 1. area weighted plane quadrics, gathered per vertex so no two threads write the same one
+    vector<Quadric> quadrics(nv);
+    parallel_for(nv, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) {
+            for (uint32_t k = adj.start[v]; k < adj.start[v + 1]; ++k) {
+                const uint32_t *f = &indices[size_t(adj.faces[k]) * 3];
+                double n[3];
+                face_normal(pos, f[0], f[1], f[2], n);
+                double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (len == 0) continue;
+                double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+                double d = -(a * pos.x[f[0]] + b * pos.y[f[0]] + c * pos.z[f[0]]);
+                quadrics[v].add_plane(a, b, c, d, len * 0.5);
+            }
+        }
+    }, threads);
+
+    vector<uint32_t> redirect(nv, kNoVertex);
+    vector<atomic<uint64_t>> ring_min(nv);
+    vector<uint64_t> ring2_min(nv);
+    vector<char> locked(nv), blocked(nv);
+    size_t widen = kWiden;
+
+    while (indices.size() / 3 > target_triangles) {
+        ++stats.passes;
+        size_t needed = (indices.size() / 3 - target_triangles + 1) / 2;
+
+        // Step 2. edges (each once, from its lower vertex) and locked vertices
+        unsigned chunks = parallel_chunks(nv, threads);
+        vector<vector<Edge>> chunk_edges(chunks);
+        parallel_for(nv, [&](size_t begin, size_t end, unsigned chunk) {
+            vector<pair<uint32_t, uint32_t>> ring;
+            for (size_t v = begin; v < end; ++v) {
+                neighbours(adj, indices, uint32_t(v), ring);
+                bool lock = false;
+                for (auto &n : ring) lock = lock || n.second != 2; // boundary or non-manifold
+                locked[v] = lock;
+                for (auto &n : ring)
+                    if (n.first > v) chunk_edges[chunk].push_back({uint32_t(v), n.first, 0, 0, 0, kNoKey});
+            }
+        }, threads);
+
+        vector<Edge> edges;
+        for (auto &e : chunk_edges) edges.insert(edges.end(), e.begin(), e.end());
+        chunk_edges.clear();
+        if (edges.empty()) break;
+
+        // Step 3. price every edge
+        vector<float> costs(edges.size());
+        parallel_for(edges.size(), [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                Edge &e = edges[i];
+                costs[i] = numeric_limits<float>::infinity();
+                if (locked[e.keep] && locked[e.remove]) continue;
+                if (locked[e.keep] == 0 && locked[e.remove]) swap(e.keep, e.remove);
+
+                Quadric q = quadrics[e.keep];
+                q += quadrics[e.remove];
+                double x = pos.x[e.keep], y = pos.y[e.keep], z = pos.z[e.keep];
+                if (locked[e.keep]) {
+                    // a boundary vertex stays where it is
+                } else if (!q.optimum(x, y, z)) {
+                    // fall back to the best of both ends and the midpoint
+                    double best = numeric_limits<double>::infinity();
+                    for (double t : {0.0, 0.5, 1.0}) {
+                        double cx = pos.x[e.keep] + t * (pos.x[e.remove] - pos.x[e.keep]);
+                        double cy = pos.y[e.keep] + t * (pos.y[e.remove] - pos.y[e.keep]);
+                        double cz = pos.z[e.keep] + t * (pos.z[e.remove] - pos.z[e.keep]);
+                        double err = q.error(cx, cy, cz);
+                        if (err < best) {
+                            best = err;
+                            x = cx; y = cy; z = cz;
+                        }
+                    }
+                }
+                e.x = float(x); e.y = float(y); e.z = float(z);
+                costs[i] = float(max(q.error(x, y, z), 0.0));
+            }
+        }, threads);
+
+        // Step 4. only the cheapest edges compete this pass
+        size_t finite = 0;
+        for (float c : costs) finite += c != numeric_limits<float>::infinity();
+        size_t candidates = min(finite, needed * widen);
+        if (candidates == 0) break;
+        vector<float> sorted_costs(costs);
+        nth_element(sorted_costs.begin(), sorted_costs.begin() + (candidates - 1), sorted_costs.end());
+        float threshold = sorted_costs[candidates - 1];
+
+        parallel_for(edges.size(), [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                if (!(costs[i] <= threshold)) continue;
+                uint32_t bits;
+                memcpy(&bits, &costs[i], 4);
+                edges[i].key = (uint64_t(bits) << 32) | i;
+            }
+        }, threads);
+
+        // Step 5. pick collapses in rounds. In a round an edge wins when it is the cheapest
+        // within two rings of both ends, so winners' triangle fans are disjoint. Winners
+        // block every vertex of their fans, later rounds only use edges clear of those.
+        fill(blocked.begin(), blocked.end(), 0);
+        vector<uint32_t> taken;
+        for (int round = 0; round < kRounds && taken.size() < needed; ++round) {
+            for (auto &m : ring_min) m.store(kNoKey, memory_order_relaxed);
+            parallel_for(edges.size(), [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = begin; i < end; ++i) {
+                    const Edge &e = edges[i];
+                    if (e.key == kNoKey || blocked[e.keep] || blocked[e.remove]) continue;
+                    atomic_min(ring_min[e.keep], e.key);
+                    atomic_min(ring_min[e.remove], e.key);
+                }
+            }, threads);
+
+            parallel_for(nv, [&](size_t begin, size_t end, unsigned) {
+                for (size_t v = begin; v < end; ++v) {
+                    uint64_t m = ring_min[v].load(memory_order_relaxed);
+                    for (uint32_t k = adj.start[v]; k < adj.start[v + 1]; ++k) {
+                        const uint32_t *f = &indices[size_t(adj.faces[k]) * 3];
+                        for (int c = 0; c < 3; ++c) m = min(m, ring_min[f[c]].load(memory_order_relaxed));
+                    }
+                    ring2_min[v] = m;
+                }
+            }, threads);
+
+            vector<vector<uint32_t>> chunk_won(parallel_chunks(edges.size(), threads));
+            parallel_for(edges.size(), [&](size_t begin, size_t end, unsigned chunk) {
+                vector<pair<uint32_t, uint32_t>> ring_a, ring_b;
+                for (size_t i = begin; i < end; ++i) {
+                    Edge &e = edges[i];
+                    if (e.key == kNoKey || blocked[e.keep] || blocked[e.remove] ||
+                        ring2_min[e.keep] != e.key || ring2_min[e.remove] != e.key) continue;
+
+                    // link condition: the ends share exactly the two opposite vertices
+                    neighbours(adj, indices, e.keep, ring_a);
+                    neighbours(adj, indices, e.remove, ring_b);
+                    size_t shared = 0;
+                    for (size_t a = 0, b = 0; a < ring_a.size() && b < ring_b.size();) {
+                        if (ring_a[a].first == ring_b[b].first) { ++shared; ++a; ++b; }
+                        else if (ring_a[a].first < ring_b[b].first) ++a;
+                        else ++b;
+                    }
+                    // a rejected edge steps aside so its neighbours can win the next round
+                    if (shared != 2 || !keeps_orientation(adj, indices, pos, e.keep, e.remove, e.x, e.y, e.z)) {
+                        e.key = kNoKey;
+                        continue;
+                    }
+                    chunk_won[chunk].push_back(uint32_t(i));
+                }
+            }, threads);
+
+            size_t won = 0;
+            for (auto &w : chunk_won) {
+                for (uint32_t i : w) {
+                    for (uint32_t v : {edges[i].keep, edges[i].remove})
+                        for (uint32_t k = adj.start[v]; k < adj.start[v + 1]; ++k) {
+                            const uint32_t *f = &indices[size_t(adj.faces[k]) * 3];
+                            blocked[f[0]] = blocked[f[1]] = blocked[f[2]] = 1;
+                        }
+                    taken.push_back(i);
+                    ++won;
+                }
+            }
+            if (won == 0) break;
+        }
+
+        if (taken.empty()) {
+            // nothing safe among the cheapest edges, let more of them compete
+            if (candidates == finite) break;
+            widen *= 4;
+            continue;
+        }
+        widen = kWiden;
+        if (taken.size() > needed) {
+            nth_element(taken.begin(), taken.begin() + needed, taken.end(),
+                        [&](uint32_t a, uint32_t b) { return edges[a].key < edges[b].key; });
+            taken.resize(needed);
+        }
+
+        // Step 6. collapse. Fans are disjoint, so every vertex and face is written by one collapse at most
+        parallel_for(taken.size(), [&](size_t begin, size_t end, unsigned) {
+            for (size_t k = begin; k < end; ++k) {
+                const Edge &e = edges[taken[k]];
+                pos.x[e.keep] = e.x;
+                pos.y[e.keep] = e.y;
+                pos.z[e.keep] = e.z;
+                quadrics[e.keep] += quadrics[e.remove];
+                redirect[e.remove] = e.keep;
+            }
+        }, threads, 256);
+
+        size_t faces = indices.size() / 3;
+        vector<char> alive(faces);
+        parallel_for(faces, [&](size_t begin, size_t end, unsigned) {
+            for (size_t f = begin; f < end; ++f) {
+                uint32_t *c = &indices[f * 3];
+                for (int k = 0; k < 3; ++k)
+                    if (redirect[c[k]] != kNoVertex) c[k] = redirect[c[k]];
+                alive[f] = c[0] != c[1] && c[1] != c[2] && c[0] != c[2];
+            }
+        }, threads);
+
+        size_t kept = 0;
+        for (size_t f = 0; f < faces; ++f) {
+            if (!alive[f]) continue;
+            if (kept != f) memcpy(&indices[kept * 3], &indices[f * 3], 3 * sizeof(uint32_t));
+            ++kept;
+        }
+        indices.resize(kept * 3);
+        for (uint32_t i : taken) redirect[edges[i].remove] = kNoVertex;
+
+        adj.build(nv, indices);
+    }
+
+    // Step 7. drop unreferenced vertices, keeping the order of the rest
+    vector<uint32_t> remap(nv, kNoVertex);
+    for (uint32_t v : indices) remap[v] = 0;
+    out_.vertices.resize(0);
+    for (size_t v = 0; v < nv; ++v) {
+        if (remap[v] == kNoVertex) continue;
+        remap[v] = uint32_t(out_.vertices.size());
+        out_.vertices.x.push_back(pos.x[v]);
+        out_.vertices.y.push_back(pos.y[v]);
+        out_.vertices.z.push_back(pos.z[v]);
+    }
+    out_.indices.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) out_.indices[i] = remap[indices[i]];
+
+    stats.output_triangles = out_.indices.size() / 3;
+    if (stats_) *stats_ = stats;
+}
@@ -0,0 +1,24 @@
+#ifndef DA_SEG_DECIMATE_H
+#define DA_SEG_DECIMATE_H
+
+#include <cstddef>
+
+#include "mesh.h"
+
+struct DecimateStats {
+    size_t input_triangles = 0;
+    size_t output_triangles = 0;
+    size_t passes = 0;
+};
+
+// Quadric error edge-collapse decimation down to about target_triangles.
+//
+// Each pass prices every edge with its quadric error, then collapses in parallel
+// a set of edges that are the cheapest within two rings of both endpoints, so no
+// two collapses touch the same triangle. Collapses failing the link condition or
+// flipping a triangle are skipped; boundary and non-manifold vertices never move.
+// Stops early when no edge can be collapsed safely.
+void decimate(const IndexedMesh &mesh, size_t target_triangles, IndexedMesh &out_,
+              DecimateStats *stats_ = nullptr, unsigned threads = 0);
+
+#endif // DA_SEG_DECIMATE_H
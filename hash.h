@@ -0,0 +1,51 @@
+#ifndef DA_SEG_HASH_H
+#define DA_SEG_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// 64-bit content hash used to identify input meshes (journal, dedup).
+// The value is persisted on disk, so the algorithm must never change.
+inline uint64_t hash_bytes(const char *data, size_t len, uint64_t seed = 0x9e3779b97f4a7c15ULL)
+{
+  const uint64_t m = 0xff51afd7ed558ccdULL;
+  uint64_t h = seed ^ (len * m);
+
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t k;
+    std::memcpy(&k, data + i, 8);
+    k *= m;
+    k ^= k >> 33;
+    h = (h ^ k) * 0xc4ceb9fe1a85ec53ULL;
+  }
+
+  if (i < len) {
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, len - i);
+    h ^= tail * m;
+  }
+
+  h ^= h >> 33;
+  h *= m;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t hash_bytes(const std::string &s)
+{
+  return hash_bytes(s.data(), s.size());
+}
+
+inline std::string hash_to_hex(uint64_t h)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string out(16, '0');
+  for (int i = 15; i >= 0; --i, h >>= 4) out[i] = digits[h & 0xf];
+  return out;
+}
+
+#endif // DA_SEG_HASH_H
@@ -0,0 +1,213 @@
+#include "http_engine.h"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+
+#include <curl/curl.h>
+
+using namespace std;
+
+namespace {
+
+// One request in flight, owned by its easy handle through CURLOPT_PRIVATE
+struct Transfer {
+  CURL *easy = nullptr;
+  curl_slist *headers = nullptr;
+  HttpRequest request;
+  HttpEngine::Callback done;
+  string response;
+
+  ~Transfer()
+  {
+    curl_slist_free_all(headers);
+    if (easy) curl_easy_cleanup(easy);
+  }
+};
+
+size_t append_response(char *data, size_t size, size_t count, void *transfer)
+{
+  static_cast<Transfer *>(transfer)->response.append(data, size * count);
+  return size * count;
+}
+
+Transfer *start_transfer(HttpRequest &&request, HttpEngine::Callback &&done, bool http2)
+{
+  unique_ptr<Transfer> t(new Transfer);
+  t->request = move(request);
+  t->done = move(done);
+  t->easy = curl_easy_init();
+  if (!t->easy) return nullptr;
+
+  CURL *easy = t->easy;
+  const HttpRequest &r = t->request;
+  for (const auto &kv : r.header) t->headers = curl_slist_append(t->headers, (kv.first + ": " + kv.second).c_str());
+  curl_easy_setopt(easy, CURLOPT_URL, r.url.c_str());
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, t->headers);
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, append_response);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, t.get());
+  curl_easy_setopt(easy, CURLOPT_PRIVATE, t.get());
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  // do not add these lines in production for safty reason
+  curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 0L);
+  if (r.method != "GET") {
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, curl_off_t(r.body.size()));
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, r.body.data());
+    if (r.method != "POST") curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, r.method.c_str());
+  }
+  if (http2) {
+    // HTTP/2 over TLS when the server offers it, HTTP/1.1 otherwise
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2TLS));
+    // wait for a connection to multiplex on rather than opening a new one
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+  }
+  return t.release();
+}
+
+} // namespace
+
+HttpEngine::HttpEngine(bool http2, long max_connections)
+    : http2_(http2), max_connections_(max_connections)
+{
+    static once_flag curl_init;
+    call_once(curl_init, [] { curl_global_init(CURL_GLOBAL_ALL); });
+
+    multi_ = curl_multi_init();
+    curl_multi_setopt(multi_, CURLMOPT_PIPELINING, long(http2_ ? CURLPIPE_MULTIPLEX : 0));
+    curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, max_connections_);
+    thread_ = thread(&HttpEngine::loop, this);
+}
+
+HttpEngine::~HttpEngine()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    curl_multi_wakeup(multi_);
+    thread_.join();
+    curl_multi_cleanup(multi_);
+}
+
+void HttpEngine::submit(HttpRequest request, Callback done)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        queue_.push_back({move(request), move(done)});
+    }
+    curl_multi_wakeup(multi_);
+}
+
+cpr::Response HttpEngine::perform(HttpRequest request)
+{
+    promise<cpr::Response> response;
+    future<cpr::Response> ready = response.get_future();
+    submit(move(request), [&response](cpr::Response r) { response.set_value(move(r)); });
+    return ready.get();
+}
+
+void HttpEngine::schedule(chrono::milliseconds delay, function<void()> fn)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        timers_.emplace(chrono::steady_clock::now() + delay, move(fn));
+    }
+    curl_multi_wakeup(multi_);
+}
+
+HttpEngineStats HttpEngine::stats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void HttpEngine::print_stats(ostream &os) const
+{
+    HttpEngineStats s = stats();
+    os << "http engine: " << s.requests << " requests, " << s.failed << " failed, " << s.http2 << " over HTTP/2, "
+       << s.connections << " connections opened" << endl;
+}
+
+void HttpEngine::loop()
+{
+    int running = 0;
+    for (;;) {
+        // Step 1. hand new requests to curl
+        deque<Pending> incoming;
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (stop_ && queue_.empty() && timers_.empty() && running == 0) break;
+            incoming.swap(queue_);
+        }
+        for (auto &p : incoming) {
+            Transfer *t = start_transfer(move(p.request), move(p.done), http2_);
+            if (!t) {
+                cpr::Response r;
+                r.error = cpr::Error(CURLE_OUT_OF_MEMORY, string("could not create a curl handle"));
+                p.done(move(r));
+                continue;
+            }
+            curl_multi_add_handle(multi_, t->easy);
+            ++running;
+        }
+
+        // Step 2. move every transfer along, then complete the finished ones
+        curl_multi_perform(multi_, &running);
+        int left;
+        while (CURLMsg *msg = curl_multi_info_read(multi_, &left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Transfer *t;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char **>(&t));
+            unique_ptr<Transfer> owned(t);
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi_, t->easy);
+
+            cpr::Response r;
+            long version = 0, connects = 0;
+            curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &r.status_code);
+            curl_easy_getinfo(t->easy, CURLINFO_TOTAL_TIME, &r.elapsed);
+            curl_easy_getinfo(t->easy, CURLINFO_HTTP_VERSION, &version);
+            curl_easy_getinfo(t->easy, CURLINFO_NUM_CONNECTS, &connects);
+            r.url = cpr::Url{t->request.url};
+            r.text = move(t->response);
+            if (result != CURLE_OK) r.error = cpr::Error(result, string(curl_easy_strerror(result)));
+
+            if (http2_ && result == CURLE_OK && version != CURL_HTTP_VERSION_2_0 && !http1_seen_) {
+                http1_seen_ = true;
+                curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, max(max_connections_, kHttp1Connections));
+            }
+            {
+                lock_guard<mutex> lock(mutex_);
+                ++stats_.requests;
+                stats_.failed += result != CURLE_OK;
+                stats_.http2 += version == CURL_HTTP_VERSION_2_0;
+                stats_.connections += size_t(connects);
+            }
+            t->done(move(r));
+        }
+
+        // Step 3. timers that are due
+        int timeout_ms = 1000;
+        for (;;) {
+            function<void()> fn;
+            {
+                lock_guard<mutex> lock(mutex_);
+                if (timers_.empty()) break;
+                auto due = timers_.begin()->first;
+                auto now = chrono::steady_clock::now();
+                if (due > now) {
+                    auto wait = chrono::duration_cast<chrono::milliseconds>(due - now).count() + 1;
+                    timeout_ms = int(min<long long>(timeout_ms, wait));
+                    break;
+                }
+                fn = move(timers_.begin()->second);
+                timers_.erase(timers_.begin());
+            }
+            fn();
+        }
+
+        // Step 4. sleep until a socket is ready, submit() or schedule() wakes us, or a timer is due
+        curl_multi_poll(multi_, nullptr, 0, timeout_ms, nullptr);
+    }
+}
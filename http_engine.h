@@ -0,0 +1,91 @@
+#ifndef DA_SEG_HTTP_ENGINE_H
+#define DA_SEG_HTTP_ENGINE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include <cpr/cpr.h>
+
+struct HttpRequest {
+    std::string method = "GET";   // GET, POST or PUT
+    std::string url;
+    cpr::Header header;
+    std::string body;
+};
+
+struct HttpEngineStats {
+    size_t requests = 0;
+    size_t failed = 0;          // transfer errors, not HTTP error statuses
+    size_t http2 = 0;           // responses that came over HTTP/2
+    size_t connections = 0;     // new connections opened
+};
+
+// Runs HTTP requests from any number of threads on one event thread, over a
+// single curl multi handle. With http2, requests ask for HTTP/2 (negotiated
+// by TLS ALPN) and wait for an open connection to multiplex on instead of
+// opening their own, so all requests to one host share at most
+// max_connections connections. A server without HTTP/2 is spoken to in
+// HTTP/1.1; the first such response lifts the limit to
+// kHttp1Connections, as requests can no longer share a connection.
+//
+// Callers that must not block chain their work in submit() callbacks and
+// schedule() timers instead, so one event thread carries any number of
+// concurrent transfers.
+// This is a thread-safe class.
+class HttpEngine {
+public:
+    using Callback = std::function<void(cpr::Response)>;
+
+    static constexpr long kHttp1Connections = 32;
+
+    explicit HttpEngine(bool http2 = true, long max_connections = 2);
+    // Finishes the requests already submitted, then stops the event thread.
+    ~HttpEngine();
+
+    HttpEngine(const HttpEngine &) = delete;
+    HttpEngine &operator=(const HttpEngine &) = delete;
+
+    // done runs on the event thread once the response is complete; it must
+    // not block.
+    void submit(HttpRequest request, Callback done);
+
+    // Blocks the calling thread until the response is complete
+    cpr::Response perform(HttpRequest request);
+
+    // Runs fn on the event thread once delay has passed; fn must not block.
+    void schedule(std::chrono::milliseconds delay, std::function<void()> fn);
+
+    HttpEngineStats stats() const;
+    void print_stats(std::ostream &os) const;
+
+private:
+    struct Pending {
+        HttpRequest request;
+        Callback done;
+    };
+
+    void loop();
+
+    bool http2_;
+    long max_connections_;
+    void *multi_;             // CURLM
+    bool http1_seen_ = false; // event thread only
+
+    mutable std::mutex mutex_;
+    std::deque<Pending> queue_;
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> timers_;
+    bool stop_ = false;
+    HttpEngineStats stats_;
+
+    std::thread thread_;
+};
+
+#endif // DA_SEG_HTTP_ENGINE_H
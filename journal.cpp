@@ -0,0 +1,205 @@
+#include "journal.h"
+#include "hash.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t kFlushBytes = 64 * 1024;
+
+bool resumable(const string &state)
+{
+  return state == "uploaded" || state == "submitted" || state == "completed";
+}
+
+// Line format: hash \t jaw_type \t state \t urn \t run_id \n
+string format_line(const JournalEntry &e)
+{
+  return hash_to_hex(e.input_hash) + '\t' + e.jaw_type + '\t' + e.state + '\t' + e.urn + '\t' + e.run_id + '\n';
+}
+
+bool parse_line(const string &line, JournalEntry &e)
+{
+  vector<string> fields;
+  stringstream ss(line);
+  string field;
+  while (getline(ss, field, '\t')) fields.push_back(field);
+  if (line.size() && line.back() == '\t') fields.push_back("");
+  if (fields.size() != 5 || fields[0].size() != 16 || fields[1].size() != 1) return false;
+
+  char *end = nullptr;
+  e.input_hash = strtoull(fields[0].c_str(), &end, 16);
+  if (*end != '\0') return false;
+  e.jaw_type = fields[1][0];
+  e.state = fields[2];
+  e.urn = fields[3];
+  e.run_id = fields[4];
+  return !e.state.empty();
+}
+
+} // namespace
+
+JobJournal::JobJournal(const string &path, chrono::milliseconds flush_interval)
+    : path_(path), flush_interval_(flush_interval)
+{
+}
+
+JobJournal::~JobJournal()
+{
+    if (writer_.joinable()) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        writer_.join();
+    }
+    if (fd_ >= 0) close(fd_);
+}
+
+bool JobJournal::open(string &error_msg_)
+{
+    // Step 1. replay. A crash can leave a torn last line, it has no '\n' and is dropped.
+    ifstream infile(path_, ifstream::binary);
+    if (infile.is_open()) {
+        string content((istreambuf_iterator<char>(infile)), istreambuf_iterator<char>());
+        size_t begin = 0, end;
+        while ((end = content.find('\n', begin)) != string::npos) {
+            JournalEntry e;
+            if (parse_line(content.substr(begin, end - begin), e))
+                latest_[{e.input_hash, e.jaw_type}] = e;
+            begin = end + 1;
+        }
+    }
+
+    // Step 2. start appending
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        error_msg_ = "could not open journal '" + path_ + "': " + strerror(errno);
+        return false;
+    }
+
+    writer_ = thread(&JobJournal::writer_loop, this);
+    return true;
+}
+
+bool JobJournal::lookup(uint64_t input_hash, char jaw_type, JournalEntry &entry) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = latest_.find({input_hash, jaw_type});
+    if (it == latest_.end() || !resumable(it->second.state)) return false;
+    entry = it->second;
+    return true;
+}
+
+vector<JournalEntry> JobJournal::pending() const
+{
+    lock_guard<mutex> lock(mutex_);
+    vector<JournalEntry> entries;
+    for (const auto &kv : latest_)
+        if (resumable(kv.second.state)) entries.push_back(kv.second);
+    return entries;
+}
+
+void JobJournal::record(const JournalEntry &entry)
+{
+    bool wake;
+    {
+        lock_guard<mutex> lock(mutex_);
+        // later transitions keep the urn/run_id learned by earlier ones
+        JournalEntry &e = latest_[{entry.input_hash, entry.jaw_type}];
+        string urn = entry.urn.empty() ? e.urn : entry.urn;
+        string run_id = entry.run_id.empty() ? e.run_id : entry.run_id;
+        e = entry;
+        e.urn = urn;
+        e.run_id = run_id;
+
+        queued_ += format_line(e);
+        ++queued_seq_;
+        wake = queued_.size() >= kFlushBytes;
+    }
+    if (wake) wake_.notify_one();
+}
+
+bool JobJournal::flush(string &error_msg_)
+{
+    unique_lock<mutex> lock(mutex_);
+    if (writer_.joinable()) {
+        uint64_t target = queued_seq_;
+        ++flush_waiters_;
+        wake_.notify_one();
+        flushed_.wait(lock, [&] { return synced_seq_ >= target || !error_.empty(); });
+        --flush_waiters_;
+    }
+    if (error_.empty()) return true;
+    error_msg_ = error_;
+    return false;
+}
+
+bool JobJournal::write_batch(const string &batch, string &error_msg_)
+{
+    // a failed write is cut off again where possible, so no partial line is left
+    off_t start = lseek(fd_, 0, SEEK_END);
+    const char *p = batch.data();
+    size_t left = batch.size();
+    while (left > 0) {
+        ssize_t n = write(fd_, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error_msg_ = "journal write to '" + path_ + "' failed: " + strerror(errno);
+            if (start >= 0 && ftruncate(fd_, start) != 0) error_msg_ += ", the last line may be torn";
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    if (fdatasync(fd_) != 0) {
+        error_msg_ = "journal sync of '" + path_ + "' failed: " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void JobJournal::writer_loop()
+{
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+        // records arriving within one interval share a single fsync
+        wake_.wait_for(lock, flush_interval_, [&] {
+            return stop_ || queued_.size() >= kFlushBytes ||
+                   (flush_waiters_ > 0 && synced_seq_ < queued_seq_ && error_.empty());
+        });
+
+        string batch;
+        batch.swap(queued_);
+        uint64_t seq = queued_seq_;
+        bool stopping = stop_;
+
+        // after a failure, lines are dropped rather than appended behind a torn one
+        if (!batch.empty() && error_.empty()) {
+            lock.unlock();
+            string error_msg;
+            bool ok = write_batch(batch, error_msg);
+            lock.lock();
+            if (!ok) {
+                error_ = error_msg;
+                cerr << error_ << endl;
+            }
+        }
+
+        if (error_.empty()) synced_seq_ = seq;
+        flushed_.notify_all();
+        if (stopping && queued_.empty()) return;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef DA_SEG_JOURNAL_H
+#define DA_SEG_JOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// One state transition of a cloud job. States, in order:
+//   uploaded  - mesh is on the file server, urn is set
+//   submitted - /run accepted the job, run_id is set
+//   completed - the run finished, result not fetched yet
+//   fetched   - result downloaded, nothing left to resume
+//   failed    - the run failed on the server side
+struct JournalEntry {
+    uint64_t input_hash = 0;
+    char jaw_type = 0;
+    std::string state;
+    std::string urn;
+    std::string run_id;
+};
+
+// Append-only journal of job transitions, so a restarted process can pick up
+// runs that are still going on in the cloud instead of paying for them again.
+//
+// record() only queues the line; a background thread appends queued lines and
+// fsyncs them in batches, every flush_interval or when the queue gets long.
+// After a failed write or sync nothing more is appended, so a torn batch is
+// always the last line of the file, and every later flush() fails.
+// This is a thread-safe class, one instance can be shared by all workers.
+class JobJournal {
+public:
+    explicit JobJournal(const std::string &path,
+                        std::chrono::milliseconds flush_interval = std::chrono::milliseconds(50));
+    ~JobJournal();
+
+    JobJournal(const JobJournal &) = delete;
+    JobJournal &operator=(const JobJournal &) = delete;
+
+    // Replays the existing file and starts the writer. Must be called once before use.
+    bool open(std::string &error_msg_);
+
+    // Latest transition for this input, if the job can still be resumed
+    // (uploaded, submitted or completed).
+    bool lookup(uint64_t input_hash, char jaw_type, JournalEntry &entry) const;
+
+    // Every job whose latest state is resumable.
+    std::vector<JournalEntry> pending() const;
+
+    void record(const JournalEntry &entry);
+
+    // Blocks until everything recorded so far is on disk. Fails if the journal
+    // could not be written, then records since the failure are not durable.
+    bool flush(std::string &error_msg_);
+
+private:
+    void writer_loop();
+    bool write_batch(const std::string &batch, std::string &error_msg_);
+
+    std::string path_;
+    std::chrono::milliseconds flush_interval_;
+    int fd_ = -1;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    std::map<std::pair<uint64_t, char>, JournalEntry> latest_;
+    std::string queued_;
+    uint64_t queued_seq_ = 0;
+    uint64_t synced_seq_ = 0;
+    size_t flush_waiters_ = 0;
+    std::string error_;  // first write or sync failure, sticky
+    bool stop_ = false;
+    std::thread writer_;
+};
+
+#endif // DA_SEG_JOURNAL_H
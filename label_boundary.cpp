@@ -0,0 +1,227 @@
+#include "label_boundary.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+const uint32_t kVersion = 1;
+// hash shards per thread, so uneven shards still keep every thread busy
+const unsigned kShardsPerThread = 4;
+
+// One triangle's view of an edge
+struct HalfEdge {
+  uint64_t key;     // smaller vertex << 32 | larger vertex
+  int label;        // face label
+  uint32_t forward; // 1 when the face runs from the smaller to the larger vertex
+};
+
+struct Segment {
+  int label_a;
+  int label_b;
+  uint32_t from;
+  uint32_t to;
+
+  bool operator<(const Segment &o) const
+  {
+    if (label_a != o.label_a) return label_a < o.label_a;
+    if (label_b != o.label_b) return label_b < o.label_b;
+    if (from != o.from) return from < o.from;
+    return to < o.to;
+  }
+};
+
+inline uint32_t shard_of(uint64_t key, unsigned shards)
+{
+  return uint32_t(((key * 0x9e3779b97f4a7c15ULL) >> 32) % shards);
+}
+
+// Chains the directed segments of one label pair, segs sorted by from
+void chain(const Segment *segs, size_t n, LabelBoundaries &out)
+{
+  vector<uint8_t> used(n, 0);
+  vector<uint32_t> ends(n);
+  for (size_t i = 0; i < n; ++i) ends[i] = segs[i].to;
+  sort(ends.begin(), ends.end());
+
+  auto out_range = [&](uint32_t v) {
+    auto lo = lower_bound(segs, segs + n, v, [](const Segment &s, uint32_t x) { return s.from < x; });
+    auto hi = upper_bound(lo, segs + n, v, [](uint32_t x, const Segment &s) { return x < s.from; });
+    return make_pair(size_t(lo - segs), size_t(hi - segs));
+  };
+  auto in_count = [&](uint32_t v) {
+    return size_t(upper_bound(ends.begin(), ends.end(), v) - lower_bound(ends.begin(), ends.end(), v));
+  };
+
+  auto walk = [&](size_t s) {
+    BoundaryLine line{segs[s].label_a, segs[s].label_b, false, uint32_t(out.line_vertices.size()), 0};
+    uint32_t first = segs[s].from;
+    out.line_vertices.push_back(first);
+    for (;;) {
+      used[s] = 1;
+      uint32_t v = segs[s].to;
+      if (v == first) {
+        line.closed = true;
+        break;
+      }
+      out.line_vertices.push_back(v);
+      auto range = out_range(v);
+      size_t next = range.second;
+      for (size_t k = range.first; k < range.second; ++k)
+        if (!used[k]) {
+          next = k;
+          break;
+        }
+      if (next == range.second) break;
+      s = next;
+    }
+    line.count = uint32_t(out.line_vertices.size() - line.first);
+    out.lines.push_back(line);
+  };
+
+  // open lines start where more segments leave a vertex than arrive
+  for (size_t s = 0; s < n; ++s) {
+    if (used[s]) continue;
+    auto range = out_range(segs[s].from);
+    if (range.second - range.first > in_count(segs[s].from)) walk(s);
+  }
+  // everything left forms loops
+  for (size_t s = 0; s < n; ++s)
+    if (!used[s]) walk(s);
+}
+
+} // namespace
+
+bool extract_label_boundaries(const IndexedMesh &mesh, const vector<int> &vertex_labels,
+                              LabelBoundaries &boundaries_, string &error_msg_, unsigned threads)
+{
+    if (vertex_labels.size() != mesh.vertices.size()) {
+        error_msg_ = "label count " + to_string(vertex_labels.size()) +
+                     " does not match vertex count " + to_string(mesh.vertices.size());
+        return false;
+    }
+
+    size_t triangles = mesh.triangle_count();
+    const uint32_t *idx = mesh.indices.data();
+    unsigned chunks = parallel_chunks(triangles, threads);
+    unsigned shards = chunks * kShardsPerThread;
+
+    // Step 1. the single pass: face labels, and candidate half-edges counted into
+    // their hash shards. A face with two corners of label L has label L, so only
+    // edges whose ends differ in label can separate faces of different labels.
+    vector<int> &face_labels = boundaries_.face_labels;
+    face_labels.resize(triangles);
+    vector<vector<size_t>> counts(chunks, vector<size_t>(shards, 0));
+    const uint32_t kSkip = UINT32_MAX;
+    vector<uint32_t> edge_shard(triangles * 3);
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned chunk) {
+        // branch-free, vectorized
+        for (size_t t = begin; t < end; ++t)
+            face_labels[t] = majority_label(vertex_labels[idx[t * 3]], vertex_labels[idx[t * 3 + 1]],
+                                            vertex_labels[idx[t * 3 + 2]]);
+        auto &count = counts[chunk];
+        for (size_t i = begin * 3; i < end * 3; ++i) {
+            uint32_t a = idx[i], b = idx[i - i % 3 + (i + 1) % 3];
+            if (vertex_labels[a] == vertex_labels[b]) {
+                edge_shard[i] = kSkip;
+                continue;
+            }
+            uint64_t key = uint64_t(min(a, b)) << 32 | max(a, b);
+            edge_shard[i] = shard_of(key, shards);
+            ++count[edge_shard[i]];
+        }
+    }, threads);
+
+    // Step 2. scatter the half-edges shard by shard
+    vector<size_t> shard_start(shards + 1, 0);
+    vector<vector<size_t>> offsets(chunks, vector<size_t>(shards));
+    for (unsigned s = 0; s < shards; ++s) {
+        size_t at = shard_start[s];
+        for (unsigned c = 0; c < chunks; ++c) {
+            offsets[c][s] = at;
+            at += counts[c][s];
+        }
+        shard_start[s + 1] = at;
+    }
+    vector<HalfEdge> edges(shard_start[shards]);
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned chunk) {
+        auto &offset = offsets[chunk];
+        for (size_t i = begin * 3; i < end * 3; ++i) {
+            if (edge_shard[i] == kSkip) continue;
+            uint32_t a = idx[i], b = idx[i - i % 3 + (i + 1) % 3];
+            edges[offset[edge_shard[i]]++] = {uint64_t(min(a, b)) << 32 | max(a, b), face_labels[i / 3], a < b};
+        }
+    }, threads);
+
+    // Step 3. per shard: sort by edge, an edge whose two faces disagree is a boundary segment.
+    // Edges on the mesh border or shared by more than two faces are not boundaries.
+    vector<vector<Segment>> shard_segments(shards);
+    parallel_for(shards, [&](size_t begin, size_t end, unsigned) {
+        for (size_t s = begin; s < end; ++s) {
+            auto first = edges.begin() + shard_start[s], last = edges.begin() + shard_start[s + 1];
+            sort(first, last, [](const HalfEdge &x, const HalfEdge &y) { return x.key < y.key; });
+            for (auto e = first; e != last;) {
+                auto next = e + 1;
+                while (next != last && next->key == e->key) ++next;
+                if (next - e == 2 && e[0].label != e[1].label) {
+                    const HalfEdge &a = e[0].label < e[1].label ? e[0] : e[1];
+                    const HalfEdge &b = e[0].label < e[1].label ? e[1] : e[0];
+                    uint32_t lo = uint32_t(a.key >> 32), hi = uint32_t(a.key);
+                    shard_segments[s].push_back({a.label, b.label, a.forward ? lo : hi, a.forward ? hi : lo});
+                }
+                e = next;
+            }
+        }
+    }, threads, 1);
+
+    // Step 4. chain the segments of each label pair into lines
+    vector<Segment> segments;
+    for (auto &s : shard_segments) segments.insert(segments.end(), s.begin(), s.end());
+    sort(segments.begin(), segments.end());
+    boundaries_.lines.clear();
+    boundaries_.line_vertices.clear();
+    for (size_t i = 0; i < segments.size();) {
+        size_t j = i;
+        while (j < segments.size() && segments[j].label_a == segments[i].label_a &&
+               segments[j].label_b == segments[i].label_b) ++j;
+        chain(&segments[i], j - i, boundaries_);
+        i = j;
+    }
+    return true;
+}
+
+bool write_label_boundaries(ostream &out, const LabelBoundaries &b, string &error_msg_)
+{
+    auto put32 = [&](uint32_t v) { out.write(reinterpret_cast<const char *>(&v), 4); };
+
+    bool small = all_of(b.face_labels.begin(), b.face_labels.end(), [](int l) { return l >= 0 && l <= 255; });
+    out.write("QBND", 4);
+    put32(kVersion);
+    put32(uint32_t(b.face_labels.size()));
+    put32(uint32_t(b.lines.size()));
+    put32(uint32_t(b.line_vertices.size()));
+    out.put(char(small ? 1 : 4));
+    if (small) {
+        string bytes(b.face_labels.size(), '\0');
+        for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = char(uint8_t(b.face_labels[i]));
+        out.write(bytes.data(), streamsize(bytes.size()));
+    } else {
+        out.write(reinterpret_cast<const char *>(b.face_labels.data()), streamsize(b.face_labels.size() * 4));
+    }
+    for (const auto &line : b.lines) {
+        put32(uint32_t(line.label_a));
+        put32(uint32_t(line.label_b));
+        put32(line.first);
+        put32(line.count);
+        put32(line.closed);
+    }
+    out.write(reinterpret_cast<const char *>(b.line_vertices.data()), streamsize(b.line_vertices.size() * 4));
+
+    if (!out) {
+        error_msg_ = "failed to write label boundaries";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef DA_SEG_LABEL_BOUNDARY_H
+#define DA_SEG_LABEL_BOUNDARY_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+// One polyline along the edges between faces of label_a and label_b
+// (label_a < label_b). Its vertices are line_vertices[first .. first + count),
+// ordered so faces of label_a are on the left for counter-clockwise faces.
+// Closed lines do not repeat their first vertex; open lines end where a
+// third label or the mesh border meets the boundary.
+struct BoundaryLine {
+    int label_a;
+    int label_b;
+    bool closed;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct LabelBoundaries {
+    std::vector<int> face_labels; // majority label of the vertices of every triangle
+    std::vector<BoundaryLine> lines;
+    std::vector<uint32_t> line_vertices;
+};
+
+// Face labels and boundary lines from one parallel pass over the triangles
+bool extract_label_boundaries(const IndexedMesh &mesh, const std::vector<int> &vertex_labels,
+                              LabelBoundaries &boundaries_, std::string &error_msg_, unsigned threads = 0);
+
+// Binary layout, little-endian:
+//   magic "QBND" | u32 version | u32 face count | u32 line count | u32 line vertex count |
+//   u8 bytes per face label (1: labels 0-255, 4: int32) | face labels |
+//   lines of {i32 label_a, i32 label_b, u32 first, u32 count, u32 closed} | u32 line vertices
+bool write_label_boundaries(std::ostream &out, const LabelBoundaries &boundaries, std::string &error_msg_);
+
+#endif // DA_SEG_LABEL_BOUNDARY_H
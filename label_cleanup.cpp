@@ -0,0 +1,149 @@
+#include "label_cleanup.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// Lock-free disjoint sets: a root is only ever linked below a smaller root,
+// by compare-and-swap, so concurrent unions cannot form a cycle
+class ConcurrentUnionFind {
+public:
+  explicit ConcurrentUnionFind(size_t n, unsigned threads) : parent_(n)
+  {
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+      for (size_t v = begin; v < end; ++v) parent_[v].store(uint32_t(v), memory_order_relaxed);
+    }, threads);
+  }
+
+  uint32_t find(uint32_t v)
+  {
+    for (;;) {
+      uint32_t p = parent_[v].load(memory_order_relaxed);
+      if (p == v) return v;
+      uint32_t grandparent = parent_[p].load(memory_order_relaxed);
+      // path halving; losing the race only means less compression
+      if (grandparent != p) parent_[v].compare_exchange_weak(p, grandparent, memory_order_relaxed);
+      v = grandparent;
+    }
+  }
+
+  void unite(uint32_t a, uint32_t b)
+  {
+    for (;;) {
+      a = find(a);
+      b = find(b);
+      if (a == b) return;
+      if (a < b) swap(a, b);
+      uint32_t expected = a;
+      if (parent_[a].compare_exchange_strong(expected, b, memory_order_relaxed)) return;
+    }
+  }
+
+private:
+  vector<atomic<uint32_t>> parent_;
+};
+
+} // namespace
+
+bool clean_label_islands(const IndexedMesh &mesh, vector<int> &labels_, size_t min_vertices,
+                         LabelCleanupStats &stats_, string &error_msg_, unsigned threads)
+{
+    VertexAdjacency adjacency;
+    build_vertex_adjacency(mesh, adjacency, threads);
+    return clean_label_islands(adjacency, labels_, min_vertices, stats_, error_msg_, threads);
+}
+
+bool clean_label_islands(const VertexAdjacency &adjacency, vector<int> &labels_, size_t min_vertices,
+                         LabelCleanupStats &stats_, string &error_msg_, unsigned threads)
+{
+    size_t n = adjacency.vertex_count();
+    if (labels_.size() != n) {
+        error_msg_ = "label count " + to_string(labels_.size()) + " does not match vertex count " + to_string(n);
+        return false;
+    }
+    stats_ = LabelCleanupStats();
+    const auto &start = adjacency.start;
+    const auto &neighbors = adjacency.neighbors;
+
+    // Step 1. union every edge whose ends share a label
+    ConcurrentUnionFind sets(n, threads);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v)
+            for (uint32_t k = start[v]; k < start[v + 1]; ++k) {
+                uint32_t u = neighbors[k];
+                if (u > v && labels_[u] == labels_[v]) sets.unite(uint32_t(v), u);
+            }
+    }, threads);
+
+    // Step 2. component of every vertex and component sizes
+    vector<uint32_t> root(n);
+    vector<atomic<uint32_t>> size(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) size[v].store(0, memory_order_relaxed);
+    }, threads);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v) {
+            root[v] = sets.find(uint32_t(v));
+            size[root[v]].fetch_add(1, memory_order_relaxed);
+        }
+    }, threads);
+
+    auto is_island = [&](uint32_t r) { return size[r].load(memory_order_relaxed) < min_vertices; };
+    for (size_t v = 0; v < n; ++v) {
+        if (root[v] != v) continue;
+        ++stats_.components;
+        if (is_island(uint32_t(v))) ++stats_.islands;
+    }
+    if (stats_.islands == 0) return true;
+
+    // Step 3. (island, neighbouring label) for every edge leaving an island
+    unsigned chunks = parallel_chunks(n, threads);
+    vector<vector<pair<uint32_t, int>>> crossings(chunks);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned chunk) {
+        auto &out = crossings[chunk];
+        for (size_t v = begin; v < end; ++v) {
+            if (!is_island(root[v])) continue;
+            for (uint32_t k = start[v]; k < start[v + 1]; ++k) {
+                uint32_t u = neighbors[k];
+                if (labels_[u] != labels_[v]) out.emplace_back(root[v], labels_[u]);
+            }
+        }
+    }, threads);
+    vector<pair<uint32_t, int>> all;
+    for (auto &c : crossings) all.insert(all.end(), c.begin(), c.end());
+    sort(all.begin(), all.end());
+
+    // Step 4. the label sharing the most edges wins, the smaller label on ties
+    vector<int> target(n);
+    vector<uint8_t> relabel(n, 0);
+    for (size_t i = 0; i < all.size();) {
+        uint32_t island = all[i].first;
+        size_t best_count = 0;
+        int best = 0;
+        while (i < all.size() && all[i].first == island) {
+            size_t j = i;
+            while (j < all.size() && all[j] == all[i]) ++j;
+            if (j - i > best_count) {
+                best_count = j - i;
+                best = all[i].second;
+            }
+            i = j;
+        }
+        target[island] = best;
+        relabel[island] = 1;
+        ++stats_.relabeled_islands;
+        stats_.relabeled_vertices += size[island].load(memory_order_relaxed);
+    }
+
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t v = begin; v < end; ++v)
+            if (relabel[root[v]]) labels_[v] = target[root[v]];
+    }, threads);
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef DA_SEG_LABEL_CLEANUP_H
+#define DA_SEG_LABEL_CLEANUP_H
+
+#include <string>
+#include <vector>
+
+#include "adjacency.h"
+#include "mesh.h"
+
+struct LabelCleanupStats {
+    size_t components = 0;         // connected same-label regions before cleanup
+    size_t islands = 0;            // regions smaller than the threshold
+    size_t relabeled_islands = 0;  // islands that had a neighbour to take a label from
+    size_t relabeled_vertices = 0;
+};
+
+// Finds the connected regions of equal label with a parallel union-find and
+// gives every region of fewer than min_vertices vertices the label it shares
+// the most edges with. Islands touching only other islands still take their
+// neighbours' old label; one pass, no iteration.
+bool clean_label_islands(const IndexedMesh &mesh, std::vector<int> &labels_, size_t min_vertices,
+                         LabelCleanupStats &stats_, std::string &error_msg_, unsigned threads = 0);
+
+// Same, for callers that already have the adjacency of the mesh
+bool clean_label_islands(const VertexAdjacency &adjacency, std::vector<int> &labels_, size_t min_vertices,
+                         LabelCleanupStats &stats_, std::string &error_msg_, unsigned threads = 0);
+
+#endif // DA_SEG_LABEL_CLEANUP_H
@@ -0,0 +1,203 @@
+#include "label_transfer.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// Average points per cell. Cells hold enough points for the distance kernel
+// to work on full vectors, but few enough that the ring search stays short.
+const double kPointsPerCell = 8;
+const size_t kKernelWidth = 8;
+
+} // namespace
+
+PointGrid::PointGrid(const Vertices &points)
+{
+    size_t n = points.size();
+    if (n == 0) return;
+
+    float hi[3];
+    const vector<float> *axes[3] = {&points.x, &points.y, &points.z};
+    for (int a = 0; a < 3; ++a) {
+        auto mm = minmax_element(axes[a]->begin(), axes[a]->end());
+        min_[a] = *mm.first;
+        hi[a] = *mm.second;
+    }
+
+    // Step 1. pick a cubic cell size giving about kPointsPerCell points per cell
+    double extent[3], volume = 1, largest = 0;
+    int solid_axes = 0;
+    for (int a = 0; a < 3; ++a) {
+        extent[a] = double(hi[a]) - min_[a];
+        largest = std::max(largest, extent[a]);
+        if (extent[a] > 0) {
+            volume *= extent[a];
+            ++solid_axes;
+        }
+    }
+    double cell = largest > 0 ? pow(volume * kPointsPerCell / n, 1.0 / max(solid_axes, 1)) : 1.0;
+    auto cells_for = [&](double c) {
+        double total = 1;
+        for (int a = 0; a < 3; ++a) total *= floor(extent[a] / c) + 1;
+        return total;
+    };
+    while (cells_for(cell) > 2.0 * n + 8) cell *= 1.25;
+    cell_size_ = float(cell);
+    for (int a = 0; a < 3; ++a) dims_[a] = int64_t(floor(extent[a] / cell)) + 1;
+
+    // Step 2. counting sort of the points by cell
+    vector<uint32_t> cell_of_point(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i) {
+            cell_of_point[i] = uint32_t(cell_index(points.x[i], points.y[i], points.z[i]));
+        }
+    });
+
+    cell_start_.assign(size_t(dims_[0] * dims_[1] * dims_[2]) + 1, 0);
+    for (uint32_t c : cell_of_point) ++cell_start_[c + 1];
+    for (size_t c = 1; c < cell_start_.size(); ++c) cell_start_[c] += cell_start_[c - 1];
+
+    vector<uint32_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+    sorted_.resize(n);
+    original_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t pos = fill[cell_of_point[i]]++;
+        sorted_.x[pos] = points.x[i];
+        sorted_.y[pos] = points.y[i];
+        sorted_.z[pos] = points.z[i];
+        original_[pos] = uint32_t(i);
+    }
+}
+
+void PointGrid::cell_of(float x, float y, float z, int64_t &cx, int64_t &cy, int64_t &cz) const
+{
+    const float q[3] = {x, y, z};
+    int64_t *c[3] = {&cx, &cy, &cz};
+    for (int a = 0; a < 3; ++a) {
+        int64_t v = int64_t(floor((q[a] - min_[a]) / cell_size_));
+        *c[a] = min(max<int64_t>(v, 0), dims_[a] - 1);
+    }
+}
+
+size_t PointGrid::cell_index(float x, float y, float z) const
+{
+    int64_t cx, cy, cz;
+    cell_of(x, y, z, cx, cy, cz);
+    return size_t((cz * dims_[1] + cy) * dims_[0] + cx);
+}
+
+void PointGrid::scan_cell(size_t cell, float qx, float qy, float qz, float &best_d2, uint32_t &best) const
+{
+    const float *xs = sorted_.x.data(), *ys = sorted_.y.data(), *zs = sorted_.z.data();
+    size_t i = cell_start_[cell], end = cell_start_[cell + 1];
+
+    // fixed-width blocks: the distance loop has no branches and is vectorized
+    float d2[kKernelWidth];
+    for (; i + kKernelWidth <= end; i += kKernelWidth) {
+        for (size_t k = 0; k < kKernelWidth; ++k) {
+            float dx = xs[i + k] - qx, dy = ys[i + k] - qy, dz = zs[i + k] - qz;
+            d2[k] = dx * dx + dy * dy + dz * dz;
+        }
+        for (size_t k = 0; k < kKernelWidth; ++k)
+            if (d2[k] < best_d2) {
+                best_d2 = d2[k];
+                best = uint32_t(i + k);
+            }
+    }
+    for (; i < end; ++i) {
+        float dx = xs[i] - qx, dy = ys[i] - qy, dz = zs[i] - qz;
+        float d = dx * dx + dy * dy + dz * dz;
+        if (d < best_d2) {
+            best_d2 = d;
+            best = uint32_t(i);
+        }
+    }
+}
+
+int64_t PointGrid::nearest(float qx, float qy, float qz) const
+{
+    if (sorted_.size() == 0) return -1;
+
+    int64_t cx, cy, cz;
+    cell_of(qx, qy, qz, cx, cy, cz);
+
+    float best_d2 = numeric_limits<float>::infinity();
+    uint32_t best = 0;
+    int64_t max_ring = max(dims_[0], max(dims_[1], dims_[2]));
+
+    // visit shells of cells at Chebyshev distance r, growing until the best hit
+    // is closer than any cell not visited yet
+    for (int64_t r = 0; r <= max_ring; ++r) {
+        int64_t z0 = max<int64_t>(cz - r, 0), z1 = min(cz + r, dims_[2] - 1);
+        int64_t y0 = max<int64_t>(cy - r, 0), y1 = min(cy + r, dims_[1] - 1);
+        for (int64_t z = z0; z <= z1; ++z) {
+            for (int64_t y = y0; y <= y1; ++y) {
+                bool on_shell = llabs(z - cz) == r || llabs(y - cy) == r;
+                size_t row = size_t((z * dims_[1] + y) * dims_[0]);
+                if (on_shell) {
+                    int64_t x0 = max<int64_t>(cx - r, 0), x1 = min(cx + r, dims_[0] - 1);
+                    for (int64_t x = x0; x <= x1; ++x) scan_cell(row + x, qx, qy, qz, best_d2, best);
+                } else {
+                    if (cx - r >= 0) scan_cell(row + cx - r, qx, qy, qz, best_d2, best);
+                    if (r > 0 && cx + r < dims_[0]) scan_cell(row + cx + r, qx, qy, qz, best_d2, best);
+                }
+            }
+        }
+        // distance from the query to the nearest face of the visited block that
+        // still has cells behind it; nothing unvisited can be closer than that
+        float reach = numeric_limits<float>::infinity();
+        const float q[3] = {qx, qy, qz};
+        const int64_t c[3] = {cx, cy, cz};
+        for (int a = 0; a < 3; ++a) {
+            if (c[a] - r > 0) reach = min(reach, q[a] - (min_[a] + float(c[a] - r) * cell_size_));
+            if (c[a] + r + 1 < dims_[a]) reach = min(reach, min_[a] + float(c[a] + r + 1) * cell_size_ - q[a]);
+        }
+        if (reach == numeric_limits<float>::infinity() || (reach > 0 && best_d2 <= reach * reach)) break;
+    }
+    return original_[best];
+}
+
+bool transfer_labels(const Vertices &source, const vector<int> &source_labels,
+                     const Vertices &target, vector<int> &target_labels_,
+                     string &error_msg_, unsigned threads)
+{
+    if (source.size() != source_labels.size()) {
+        error_msg_ = "label count " + to_string(source_labels.size()) +
+                     " does not match vertex count " + to_string(source.size());
+        return false;
+    }
+    if (source.size() == 0) {
+        error_msg_ = "source mesh has no vertices";
+        return false;
+    }
+
+    PointGrid grid(source);
+
+    // visit targets in cell order, so neighbouring queries reuse the same cells in cache
+    size_t n = target.size();
+    vector<uint32_t> target_cell(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i)
+            target_cell[i] = uint32_t(grid.cell_index(target.x[i], target.y[i], target.z[i]));
+    }, threads);
+
+    vector<uint32_t> offsets(grid.cell_count() + 1, 0);
+    for (uint32_t c : target_cell) ++offsets[c + 1];
+    for (size_t c = 1; c < offsets.size(); ++c) offsets[c] += offsets[c - 1];
+    vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[offsets[target_cell[i]]++] = uint32_t(i);
+
+    target_labels_.resize(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t k = begin; k < end; ++k) {
+            size_t i = order[k];
+            target_labels_[i] = source_labels[size_t(grid.nearest(target.x[i], target.y[i], target.z[i]))];
+        }
+    }, threads);
+    return true;
+}
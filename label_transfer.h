@@ -0,0 +1,41 @@
+#ifndef DA_SEG_LABEL_TRANSFER_H
+#define DA_SEG_LABEL_TRANSFER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+// Uniform grid over a point set for nearest neighbour queries.
+// Points are stored sorted by cell, so each cell is a contiguous run of x/y/z floats.
+class PointGrid {
+public:
+    explicit PointGrid(const Vertices &points);
+
+    // Index (into the original points) of the nearest point, -1 if the grid is empty
+    int64_t nearest(float qx, float qy, float qz) const;
+
+    // Cell a query falls into, queries sorted by it touch memory in order
+    size_t cell_index(float x, float y, float z) const;
+    size_t cell_count() const { return cell_start_.empty() ? 0 : cell_start_.size() - 1; }
+
+private:
+    void cell_of(float x, float y, float z, int64_t &cx, int64_t &cy, int64_t &cz) const;
+    void scan_cell(size_t cell, float qx, float qy, float qz, float &best_d2, uint32_t &best) const;
+
+    float min_[3] = {0, 0, 0};
+    float cell_size_ = 1;
+    int64_t dims_[3] = {0, 0, 0};
+    std::vector<uint32_t> cell_start_;   // CSR offsets, one per cell plus one
+    Vertices sorted_;
+    std::vector<uint32_t> original_;     // sorted position -> original index
+};
+
+// Gives every target vertex the label of the nearest source vertex.
+// Used to bring labels of the preprocessed result mesh back onto the original scan.
+bool transfer_labels(const Vertices &source, const std::vector<int> &source_labels,
+                     const Vertices &target, std::vector<int> &target_labels_,
+                     std::string &error_msg_, unsigned threads = 0);
+
+#endif // DA_SEG_LABEL_TRANSFER_H
@@ -0,0 +1,154 @@
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// a plain pointer, so reading it in operator new needs no TLS initialization
+thread_local MemoryArena *current_arena = nullptr;
+
+inline void charge(void *p)
+{
+  MemoryArena *arena = current_arena;
+  if (!arena || !p) return;
+  int64_t size = int64_t(malloc_usable_size(p));
+  arena->allocations.fetch_add(1, memory_order_relaxed);
+  arena->allocated_bytes.fetch_add(uint64_t(size), memory_order_relaxed);
+  int64_t live = arena->live_bytes.fetch_add(size, memory_order_relaxed) + size;
+  int64_t peak = arena->peak_bytes.load(memory_order_relaxed);
+  while (live > peak && !arena->peak_bytes.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+  }
+}
+
+inline void credit(void *p)
+{
+  MemoryArena *arena = current_arena;
+  if (!arena || !p) return;
+  arena->live_bytes.fetch_sub(int64_t(malloc_usable_size(p)), memory_order_relaxed);
+}
+
+void *allocate(size_t size)
+{
+  for (;;) {
+    void *p = malloc(size ? size : 1);
+    if (p) {
+      charge(p);
+      return p;
+    }
+    new_handler handler = get_new_handler();
+    if (!handler) throw bad_alloc();
+    handler();
+  }
+}
+
+void *allocate_aligned(size_t size, align_val_t alignment)
+{
+  for (;;) {
+    void *p = nullptr;
+    size_t a = max(size_t(alignment), sizeof(void *));
+    if (posix_memalign(&p, a, size ? size : 1) == 0) {
+      charge(p);
+      return p;
+    }
+    new_handler handler = get_new_handler();
+    if (!handler) throw bad_alloc();
+    handler();
+  }
+}
+
+void release(void *p) noexcept
+{
+  credit(p);
+  free(p);
+}
+
+double to_mb(double bytes)
+{
+  return bytes / (1024 * 1024);
+}
+
+} // namespace
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, align_val_t alignment) { return allocate_aligned(size, alignment); }
+void *operator new[](size_t size, align_val_t alignment) { return allocate_aligned(size, alignment); }
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+void operator delete[](void *p, size_t) noexcept { release(p); }
+void operator delete(void *p, align_val_t) noexcept { release(p); }
+void operator delete[](void *p, align_val_t) noexcept { release(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { release(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { release(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { release(p); }
+
+string MemoryArena::str() const
+{
+    ostringstream oss;
+    oss.precision(1);
+    oss << fixed << allocations.load() << " allocations, " << to_mb(double(allocated_bytes.load())) << " MB allocated, peak "
+        << to_mb(double(peak_bytes.load())) << " MB live";
+    return oss.str();
+}
+
+MemoryScope::MemoryScope(MemoryArena *arena) : previous_(current_arena)
+{
+    current_arena = arena;
+}
+
+MemoryScope::~MemoryScope()
+{
+    current_arena = previous_;
+}
+
+MemoryArena *current_memory_arena()
+{
+    return current_arena;
+}
+
+ProcessMemory process_memory()
+{
+    ProcessMemory m;
+    // ru_maxrss is in kilobytes on Linux
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) m.peak_rss = size_t(usage.ru_maxrss) * 1024;
+
+    // second field of statm: resident pages
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        unsigned long size = 0, resident = 0;
+        if (fscanf(f, "%lu %lu", &size, &resident) == 2) m.rss = size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+        fclose(f);
+    }
+    return m;
+}
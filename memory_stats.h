@@ -0,0 +1,49 @@
+#ifndef DA_SEG_MEMORY_STATS_H
+#define DA_SEG_MEMORY_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Heap accounting for one job. Every operator new / delete made by a thread
+// while a MemoryScope for the arena is active is charged to it; parallel_for
+// carries the scope over to its threads. Memory allocated before the scope
+// and freed inside it is credited, so live_bytes can dip below zero.
+// Buffers curl allocates with malloc are not seen.
+// This is a thread-safe struct.
+struct MemoryArena {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocated_bytes{0};   // cumulative
+    std::atomic<int64_t> live_bytes{0};
+    std::atomic<int64_t> peak_bytes{0};         // highest live_bytes
+
+    // "N allocations, X MB allocated, peak Y MB live"
+    std::string str() const;
+};
+
+// Charges the allocations of the calling thread to arena until destroyed.
+// Scopes nest; a null arena stops the accounting.
+class MemoryScope {
+public:
+    explicit MemoryScope(MemoryArena *arena);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope &) = delete;
+    MemoryScope &operator=(const MemoryScope &) = delete;
+
+private:
+    MemoryArena *previous_;
+};
+
+// Arena of the calling thread, null outside any scope
+MemoryArena *current_memory_arena();
+
+struct ProcessMemory {
+    size_t rss = 0;        // bytes resident now
+    size_t peak_rss = 0;   // highest resident bytes of the process so far
+};
+
+ProcessMemory process_memory();
+
+#endif // DA_SEG_MEMORY_STATS_H
@@ -0,0 +1,240 @@
+#include "mesh.h"
+#include "parallel.h"
+#include "ply.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+const uint32_t kEmpty = UINT32_MAX;
+
+// + 0 folds -0 into 0, so both weld together
+inline uint32_t key_bits(float v)
+{
+  v += 0.0f;
+  uint32_t b;
+  memcpy(&b, &v, 4);
+  return b;
+}
+
+inline bool same_position(const float *a, const float *b)
+{
+  return key_bits(a[0]) == key_bits(b[0]) && key_bits(a[1]) == key_bits(b[1]) && key_bits(a[2]) == key_bits(b[2]);
+}
+
+inline uint32_t position_hash(const float *p)
+{
+  uint64_t h = key_bits(p[0]) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ key_bits(p[1])) * 0xff51afd7ed558ccdULL;
+  h = (h ^ key_bits(p[2])) * 0xc4ceb9fe1a85ec53ULL;
+  return uint32_t(h >> 32);
+}
+
+bool is_binary_stl(const string &data, uint32_t &triangles)
+{
+  if (data.size() < 84) return false;
+  memcpy(&triangles, data.data() + 80, 4);
+  return data.size() == 84 + size_t(triangles) * 50;
+}
+
+// Corner positions of every triangle, 9 floats per triangle
+bool read_stl_corners(const string &data, vector<float> &corners, string &error_msg_, unsigned threads)
+{
+  uint32_t triangles = 0;
+  if (is_binary_stl(data, triangles)) {
+    corners.resize(size_t(triangles) * 9);
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned) {
+      for (size_t t = begin; t < end; ++t)
+        memcpy(&corners[t * 9], data.data() + 84 + t * 50 + 12, 36);
+    }, threads);
+    return true;
+  }
+
+  if (data.compare(0, 5, "solid") != 0) {
+    error_msg_ = "not a binary or ASCII STL";
+    return false;
+  }
+  corners.clear();
+  const char *p = data.c_str();
+  while ((p = strstr(p, "vertex")) != nullptr) {
+    p += 6;
+    for (int i = 0; i < 3; ++i) {
+      char *end;
+      corners.push_back(strtof(p, &end));
+      if (end == p) {
+        error_msg_ = "malformed ASCII STL vertex";
+        return false;
+      }
+      p = end;
+    }
+  }
+  if (corners.size() % 9 != 0) {
+    error_msg_ = "ASCII STL has an incomplete facet";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+void weld_vertices(const vector<float> &corners, IndexedMesh &mesh_, unsigned threads)
+{
+    size_t n = corners.size() / 3;
+    const float *pos = corners.data();
+
+    // Step 1. hash every corner
+    vector<uint32_t> hashes(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i) hashes[i] = position_hash(pos + i * 3);
+    }, threads);
+
+    // Step 2. equal positions have equal hashes, so each shard of the hash space is
+    // welded independently. Corners are visited in order, the first one seen is the
+    // representative of all later copies.
+    unsigned chunks = parallel_chunks(n, threads);
+    unsigned shards = chunks;
+
+    // Step 2.1 corners per shard in each range, then where each range's share of
+    // a shard starts. Ranges are laid out in order within a shard, so every
+    // shard lists its corners in order. A single shard is all corners as they are.
+    vector<size_t> shard_begin(shards + 1, 0);
+    vector<uint32_t> members;
+    if (shards > 1) {
+        vector<size_t> starts(size_t(chunks) * shards, 0);
+        parallel_for(n, [&](size_t begin, size_t end, unsigned chunk) {
+            size_t *count = &starts[size_t(chunk) * shards];
+            for (size_t i = begin; i < end; ++i) ++count[hashes[i] % shards];
+        }, threads);
+        size_t total = 0;
+        for (unsigned shard = 0; shard < shards; ++shard) {
+            shard_begin[shard] = total;
+            for (unsigned c = 0; c < chunks; ++c) {
+                size_t count = starts[size_t(c) * shards + shard];
+                starts[size_t(c) * shards + shard] = total;
+                total += count;
+            }
+        }
+        shard_begin[shards] = total;
+
+        // Step 2.2 scatter every corner to its shard once
+        members.resize(n);
+        parallel_for(n, [&](size_t begin, size_t end, unsigned chunk) {
+            size_t *next = &starts[size_t(chunk) * shards];
+            for (size_t i = begin; i < end; ++i) members[next[hashes[i] % shards]++] = uint32_t(i);
+        }, threads);
+    } else {
+        shard_begin[1] = n;
+    }
+
+    // Step 2.3 weld each shard's own corners
+    vector<uint32_t> rep(n);
+    parallel_for(shards, [&](size_t first_shard, size_t last_shard, unsigned) {
+        vector<uint32_t> table;
+        for (size_t shard = first_shard; shard < last_shard; ++shard) {
+            size_t size = shard_begin[shard + 1] - shard_begin[shard];
+            size_t capacity = 16;
+            while (capacity < size * 2) capacity <<= 1;
+            table.assign(capacity, kEmpty);
+            size_t mask = capacity - 1;
+
+            for (size_t m = shard_begin[shard]; m < shard_begin[shard + 1]; ++m) {
+                uint32_t i = shards > 1 ? members[m] : uint32_t(m);
+                size_t slot = (hashes[i] / shards) & mask;
+                for (;;) {
+                    uint32_t other = table[slot];
+                    if (other == kEmpty) {
+                        table[slot] = i;
+                        rep[i] = i;
+                        break;
+                    }
+                    if (hashes[other] == hashes[i] && same_position(pos + size_t(other) * 3, pos + size_t(i) * 3)) {
+                        rep[i] = other;
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+            }
+        }
+    }, threads, 1);
+
+    // Step 3. number the representatives in order: per-range counts, then offsets
+    vector<size_t> offsets(chunks + 1, 0);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned chunk) {
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i) count += rep[i] == i;
+        offsets[chunk + 1] = count;
+    }, threads);
+    for (unsigned c = 0; c < chunks; ++c) offsets[c + 1] += offsets[c];
+
+    vector<uint32_t> vertex_of(n);
+    mesh_.vertices.resize(offsets[chunks]);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned chunk) {
+        size_t next = offsets[chunk];
+        for (size_t i = begin; i < end; ++i) {
+            if (rep[i] != i) continue;
+            vertex_of[i] = uint32_t(next);
+            mesh_.vertices.x[next] = pos[i * 3] + 0.0f;
+            mesh_.vertices.y[next] = pos[i * 3 + 1] + 0.0f;
+            mesh_.vertices.z[next] = pos[i * 3 + 2] + 0.0f;
+            ++next;
+        }
+    }, threads);
+
+    // Step 4. triangle indices
+    mesh_.indices.resize(n);
+    parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; ++i) mesh_.indices[i] = vertex_of[rep[i]];
+    }, threads);
+}
+
+void write_stl(const IndexedMesh &mesh, string &data_, unsigned threads)
+{
+    size_t triangles = mesh.triangle_count();
+    data_.assign(84 + triangles * 50, '\0');
+    uint32_t count = uint32_t(triangles);
+    memcpy(&data_[80], &count, 4);
+
+    const Vertices &v = mesh.vertices;
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned) {
+        for (size_t t = begin; t < end; ++t) {
+            float f[12];
+            for (int k = 0; k < 3; ++k) {
+                uint32_t i = mesh.indices[t * 3 + k];
+                f[3 + k * 3] = v.x[i];
+                f[4 + k * 3] = v.y[i];
+                f[5 + k * 3] = v.z[i];
+            }
+            float ux = f[6] - f[3], uy = f[7] - f[4], uz = f[8] - f[5];
+            float wx = f[9] - f[3], wy = f[10] - f[4], wz = f[11] - f[5];
+            float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+            float len = sqrt(nx * nx + ny * ny + nz * nz);
+            if (len > 0) {
+                nx /= len;
+                ny /= len;
+                nz /= len;
+            }
+            f[0] = nx;
+            f[1] = ny;
+            f[2] = nz;
+            memcpy(&data_[84 + t * 50], f, 48);
+        }
+    }, threads);
+}
+
+bool read_stl(const string &data, IndexedMesh &mesh_, string &error_msg_, unsigned threads)
+{
+    vector<float> corners;
+    if (!read_stl_corners(data, corners, error_msg_, threads)) return false;
+    weld_vertices(corners, mesh_, threads);
+    return true;
+}
+
+bool read_mesh(const string &data, IndexedMesh &mesh_, string &error_msg_, unsigned threads)
+{
+    if (is_ply(data)) return read_ply(data, mesh_, nullptr, error_msg_, threads);
+    return read_stl(data, mesh_, error_msg_, threads);
+}
@@ -0,0 +1,48 @@
+#ifndef DA_SEG_MESH_H
+#define DA_SEG_MESH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Vertex positions as structure of arrays, so distance loops run over contiguous floats
+struct Vertices {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+};
+
+// Triangle mesh with shared vertices. An STL repeats every vertex about six
+// times; welded, the same geometry takes roughly a sixth of the memory.
+struct IndexedMesh {
+    Vertices vertices;
+    std::vector<uint32_t> indices; // 3 per triangle
+
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// Label of a triangle from its vertex labels: the majority, or the first
+// vertex's label when all three differ
+inline int majority_label(int a, int b, int c)
+{
+    return (b == c) ? b : a;
+}
+
+// Parses a binary or ASCII STL and welds corners with bit-identical positions.
+// Vertices are numbered in order of first appearance, which is the vertex
+// order seg_labels refers to for the result mesh.
+bool read_stl(const std::string &data, IndexedMesh &mesh_, std::string &error_msg_, unsigned threads = 0);
+
+// STL or PLY, told apart by content
+bool read_mesh(const std::string &data, IndexedMesh &mesh_, std::string &error_msg_, unsigned threads = 0);
+
+// Binary STL with per-face normals
+void write_stl(const IndexedMesh &mesh, std::string &data_, unsigned threads = 0);
+
+// Welds a flat array of triangle corners (9 floats per triangle)
+void weld_vertices(const std::vector<float> &corners, IndexedMesh &mesh_, unsigned threads = 0);
+
+#endif // DA_SEG_MESH_H
@@ -0,0 +1,343 @@
+#include "mesh_archive.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const char kMagic[4] = {'Q', 'M', 'S', 'H'};
+const char kTrailer[4] = {'Q', 'E', 'N', 'D'};
+const uint8_t kVersion = 1;
+const size_t kBufferSize = 1 << 16;
+// keeps a corrupt header from asking for an absurd allocation
+const uint64_t kMaxCount = uint64_t(1) << 31;
+// a finer step is tried at most this many times when vertices share a cell
+const int kMaxHalvings = 8;
+
+inline uint64_t zigzag(int64_t v)
+{
+  return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v)
+{
+  return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+class ByteSink {
+public:
+  explicit ByteSink(ostream &out) : out_(out), buffer_(kBufferSize) {}
+
+  void put(uint8_t byte)
+  {
+    if (size_ == buffer_.size()) flush();
+    buffer_[size_++] = char(byte);
+  }
+
+  void put_raw(const void *data, size_t n)
+  {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < n; ++i) put(bytes[i]);
+  }
+
+  void put_varint(uint64_t v)
+  {
+    while (v >= 0x80) {
+      put(uint8_t(v) | 0x80);
+      v >>= 7;
+    }
+    put(uint8_t(v));
+  }
+
+  bool flush()
+  {
+    out_.write(buffer_.data(), streamsize(size_));
+    size_ = 0;
+    return bool(out_);
+  }
+
+private:
+  ostream &out_;
+  vector<char> buffer_;
+  size_t size_ = 0;
+};
+
+class ByteSource {
+public:
+  explicit ByteSource(istream &in) : in_(in), buffer_(kBufferSize) {}
+
+  bool get(uint8_t &byte)
+  {
+    if (pos_ == end_ && !fill()) return false;
+    byte = uint8_t(buffer_[pos_++]);
+    return true;
+  }
+
+  bool get_raw(void *data, size_t n)
+  {
+    uint8_t *bytes = static_cast<uint8_t *>(data);
+    for (size_t i = 0; i < n; ++i)
+      if (!get(bytes[i])) return false;
+    return true;
+  }
+
+  bool get_varint(uint64_t &v)
+  {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte;
+      if (!get(byte)) return false;
+      v |= uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+private:
+  bool fill()
+  {
+    in_.read(buffer_.data(), streamsize(buffer_.size()));
+    pos_ = 0;
+    end_ = size_t(in_.gcount());
+    return end_ > 0;
+  }
+
+  istream &in_;
+  vector<char> buffer_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+};
+
+// bits needed to store values 0..range
+inline uint8_t bit_width(uint64_t range)
+{
+  uint8_t bits = 0;
+  while (bits < 64 && (range >> bits) != 0) ++bits;
+  return bits;
+}
+
+inline int64_t quantize(float value, float origin, float precision)
+{
+  return llround((double(value) - origin) / precision);
+}
+
+// True when no two vertices at different positions fall into the same grid
+// cell. Vertices at exactly the same position are duplicates already and do
+// not count.
+bool cells_distinct(const Vertices &v, const float origin[3], float precision)
+{
+  const vector<float> *axes[3] = {&v.x, &v.y, &v.z};
+  auto cell = [&](size_t i, int a) { return quantize((*axes[a])[i], origin[a], precision); };
+
+  vector<pair<uint64_t, uint32_t>> keys(v.size());
+  for (size_t i = 0; i < v.size(); ++i) {
+    uint64_t h = uint64_t(cell(i, 0)) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ uint64_t(cell(i, 1))) * 0xff51afd7ed558ccdULL;
+    h = (h ^ uint64_t(cell(i, 2))) * 0xc4ceb9fe1a85ec53ULL;
+    keys[i] = {h, uint32_t(i)};
+  }
+  sort(keys.begin(), keys.end());
+
+  for (size_t k = 0; k < keys.size(); ++k) {
+    for (size_t l = k + 1; l < keys.size() && keys[l].first == keys[k].first; ++l) {
+      size_t i = keys[k].second, j = keys[l].second;
+      bool same_cell = true, same_position = true;
+      for (int a = 0; a < 3; ++a) {
+        same_cell = same_cell && cell(i, a) == cell(j, a);
+        same_position = same_position && (*axes[a])[i] == (*axes[a])[j];
+      }
+      if (same_cell && !same_position) return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool write_mesh_archive(ostream &out, const IndexedMesh &mesh, const vector<int> &labels,
+                        string &error_msg_, float precision)
+{
+    const Vertices &v = mesh.vertices;
+    size_t n = v.size();
+    if (!(precision > 0)) {
+        error_msg_ = "archive precision must be positive";
+        return false;
+    }
+    if (n >= kMaxCount || mesh.indices.size() >= kMaxCount || labels.size() >= kMaxCount) {
+        error_msg_ = "mesh too large for the archive format";
+        return false;
+    }
+
+    // Step 1. quantization grid anchored at the bounding box minimum. Two
+    // vertices in one cell would decode to the same position, so an unpacked
+    // STL would weld them, lose the label of one and get degenerate
+    // triangles: the step is halved until every vertex has a cell of its own.
+    float origin[3] = {0, 0, 0};
+    double extent = 0, magnitude = 0;
+    const vector<float> *axes[3] = {&v.x, &v.y, &v.z};
+    for (int a = 0; a < 3 && n > 0; ++a) {
+        auto mm = minmax_element(axes[a]->begin(), axes[a]->end());
+        origin[a] = *mm.first;
+        extent = max(extent, double(*mm.second) - origin[a]);
+        magnitude = max({magnitude, fabs(double(*mm.first)), fabs(double(*mm.second))});
+    }
+    for (int halvings = 0;; ++halvings) {
+        if (extent / precision >= double(numeric_limits<int32_t>::max())) {
+            error_msg_ = "mesh extent too large for archive precision";
+            return false;
+        }
+        if (cells_distinct(v, origin, precision)) break;
+        // below a few float steps, decoded positions would collide anyway
+        if (halvings == kMaxHalvings || precision / 2 < magnitude * ldexp(1.0, -21)) {
+            error_msg_ = "mesh has distinct vertices closer than the archive precision";
+            return false;
+        }
+        precision /= 2;
+    }
+
+    ByteSink sink(out);
+    sink.put_raw(kMagic, 4);
+    sink.put(kVersion);
+    sink.put_varint(n);
+    sink.put_varint(mesh.triangle_count());
+    sink.put_varint(labels.size());
+    sink.put_raw(&precision, 4);
+    sink.put_raw(origin, 12);
+
+    // Step 2. vertices, delta to the previous vertex per axis
+    int64_t previous[3] = {0, 0, 0};
+    for (size_t i = 0; i < n; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            int64_t q = quantize((*axes[a])[i], origin[a], precision);
+            sink.put_varint(zigzag(q - previous[a]));
+            previous[a] = q;
+        }
+    }
+
+    // Step 3. indices, relative to the next vertex not referenced yet
+    int64_t next = 0;
+    for (uint32_t index : mesh.indices) {
+        if (index >= n) {
+            error_msg_ = "index " + to_string(index) + " out of range";
+            return false;
+        }
+        sink.put_varint(zigzag(next - int64_t(index)));
+        next = max(next, int64_t(index) + 1);
+    }
+
+    // Step 4. labels, offset by the smallest one and bit-packed
+    if (!labels.empty()) {
+        auto mm = minmax_element(labels.begin(), labels.end());
+        int64_t low = *mm.first;
+        uint8_t bits = bit_width(uint64_t(int64_t(*mm.second) - low));
+        sink.put_varint(zigzag(low));
+        sink.put(bits);
+
+        uint64_t pending = 0;
+        int pending_bits = 0;
+        for (int label : labels) {
+            pending |= uint64_t(int64_t(label) - low) << pending_bits;
+            pending_bits += bits;
+            while (pending_bits >= 8) {
+                sink.put(uint8_t(pending));
+                pending >>= 8;
+                pending_bits -= 8;
+            }
+        }
+        if (pending_bits > 0) sink.put(uint8_t(pending));
+    }
+
+    sink.put_raw(kTrailer, 4);
+    if (!sink.flush()) {
+        error_msg_ = "failed to write archive";
+        return false;
+    }
+    return true;
+}
+
+bool read_mesh_archive(istream &in, IndexedMesh &mesh_, vector<int> &labels_, string &error_msg_)
+{
+    ByteSource source(in);
+    auto truncated = [&]() {
+        error_msg_ = "archive is truncated or corrupt";
+        return false;
+    };
+
+    // Step 1. header
+    char magic[4];
+    uint8_t version;
+    if (!source.get_raw(magic, 4) || memcmp(magic, kMagic, 4) != 0) {
+        error_msg_ = "not a mesh archive";
+        return false;
+    }
+    if (!source.get(version) || version != kVersion) {
+        error_msg_ = "unsupported mesh archive version";
+        return false;
+    }
+    uint64_t n, triangles, label_count;
+    float precision, origin[3];
+    if (!source.get_varint(n) || !source.get_varint(triangles) || !source.get_varint(label_count) ||
+        !source.get_raw(&precision, 4) || !source.get_raw(origin, 12)) return truncated();
+    if (n >= kMaxCount || triangles >= kMaxCount / 3 || label_count >= kMaxCount) return truncated();
+
+    // Step 2. vertices
+    Vertices &v = mesh_.vertices;
+    v.resize(size_t(n));
+    vector<float> *axes[3] = {&v.x, &v.y, &v.z};
+    int64_t previous[3] = {0, 0, 0};
+    for (size_t i = 0; i < n; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            uint64_t delta;
+            if (!source.get_varint(delta)) return truncated();
+            previous[a] += unzigzag(delta);
+            (*axes[a])[i] = float(origin[a] + double(previous[a]) * precision);
+        }
+    }
+
+    // Step 3. indices
+    mesh_.indices.resize(size_t(triangles) * 3);
+    int64_t next = 0;
+    for (auto &index : mesh_.indices) {
+        uint64_t code;
+        if (!source.get_varint(code)) return truncated();
+        int64_t value = next - unzigzag(code);
+        if (value < 0 || uint64_t(value) >= n) return truncated();
+        index = uint32_t(value);
+        next = max(next, value + 1);
+    }
+
+    // Step 4. labels
+    labels_.resize(size_t(label_count));
+    if (label_count > 0) {
+        uint64_t low_code;
+        uint8_t bits;
+        if (!source.get_varint(low_code) || !source.get(bits) || bits > 32) return truncated();
+        int64_t low = unzigzag(low_code);
+        uint64_t mask = (uint64_t(1) << bits) - 1;
+
+        uint64_t pending = 0;
+        int pending_bits = 0;
+        for (auto &label : labels_) {
+            while (pending_bits < bits) {
+                uint8_t byte;
+                if (!source.get(byte)) return truncated();
+                pending |= uint64_t(byte) << pending_bits;
+                pending_bits += 8;
+            }
+            label = int(low + int64_t(pending & mask));
+            pending >>= bits;
+            pending_bits -= bits;
+        }
+    }
+
+    char trailer[4];
+    if (!source.get_raw(trailer, 4) || memcmp(trailer, kTrailer, 4) != 0) return truncated();
+    return true;
+}
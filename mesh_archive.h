@@ -0,0 +1,35 @@
+#ifndef DA_SEG_MESH_ARCHIVE_H
+#define DA_SEG_MESH_ARCHIVE_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+// Compact storage of a segmented mesh, about 6x smaller than binary STL plus
+// text labels:
+//   - positions quantized to a fixed step, each vertex stored as a varint
+//     delta from the previous one (vertices are in first-appearance order,
+//     so neighbours in the file are neighbours on the mesh)
+//   - indices stored relative to the next vertex not referenced yet, which
+//     is 0 for every first reference
+//   - labels bit-packed with as many bits as their range needs
+// Encoding and decoding stream through a small buffer; neither holds the
+// encoded file in memory.
+
+// Quantization step in mesh units (mm): 1 um, far below scanner resolution
+const float kArchivePrecision = 0.001f;
+
+// labels may be empty. Positions are restored to within precision / 2. Distinct
+// vertices always decode to distinct positions: when two would share a grid
+// cell, the step is halved (up to 8 times, the step used is in the header),
+// and writing fails if that is not enough. Vertices at exactly the same
+// position stay separate vertices at one position.
+bool write_mesh_archive(std::ostream &out, const IndexedMesh &mesh, const std::vector<int> &labels,
+                        std::string &error_msg_, float precision = kArchivePrecision);
+
+bool read_mesh_archive(std::istream &in, IndexedMesh &mesh_, std::vector<int> &labels_, std::string &error_msg_);
+
+#endif // DA_SEG_MESH_ARCHIVE_H
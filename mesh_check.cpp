@@ -0,0 +1,226 @@
+#include "mesh_check.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// hash shards per thread, so uneven shards still keep every thread busy
+const unsigned kShardsPerThread = 4;
+
+struct EdgeRecord {
+  uint64_t key;     // smaller vertex << 32 | larger vertex
+  uint32_t forward; // 1 when the face runs from the smaller to the larger vertex
+};
+
+struct FaceRecord {
+  uint32_t v[3]; // sorted
+  uint32_t face;
+
+  bool same_vertices(const FaceRecord &o) const { return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2]; }
+  bool operator<(const FaceRecord &o) const
+  {
+    for (int k = 0; k < 3; ++k)
+      if (v[k] != o.v[k]) return v[k] < o.v[k];
+    return face < o.face;
+  }
+};
+
+inline unsigned shard_of(uint64_t h, unsigned shards)
+{
+  return unsigned(((h * 0x9e3779b97f4a7c15ULL) >> 32) % shards);
+}
+
+// Counting sort of records into hash shards. emit(item, put) calls
+// put(shard, record) for every record of an item; it runs twice per item,
+// once to count and once to place.
+template <typename Record, typename Emit>
+void scatter_to_shards(size_t items, unsigned shards, Emit emit, vector<Record> &records_, vector<size_t> &start_,
+                       unsigned threads)
+{
+  unsigned chunks = parallel_chunks(items, threads);
+  vector<vector<size_t>> offsets(chunks, vector<size_t>(shards, 0));
+  parallel_for(items, [&](size_t begin, size_t end, unsigned chunk) {
+    auto &count = offsets[chunk];
+    for (size_t i = begin; i < end; ++i) emit(i, [&](unsigned s, const Record &) { ++count[s]; });
+  }, threads);
+
+  start_.assign(shards + 1, 0);
+  for (unsigned s = 0; s < shards; ++s) {
+    size_t at = start_[s];
+    for (unsigned c = 0; c < chunks; ++c) {
+      size_t n = offsets[c][s];
+      offsets[c][s] = at;
+      at += n;
+    }
+    start_[s + 1] = at;
+  }
+
+  records_.resize(start_[shards]);
+  parallel_for(items, [&](size_t begin, size_t end, unsigned chunk) {
+    auto &offset = offsets[chunk];
+    for (size_t i = begin; i < end; ++i) emit(i, [&](unsigned s, const Record &r) { records_[offset[s]++] = r; });
+  }, threads);
+}
+
+bool is_degenerate(const IndexedMesh &mesh, size_t t)
+{
+  const uint32_t *f = &mesh.indices[t * 3];
+  if (f[0] == f[1] || f[1] == f[2] || f[0] == f[2]) return true;
+  const Vertices &p = mesh.vertices;
+  double ux = double(p.x[f[1]]) - p.x[f[0]], uy = double(p.y[f[1]]) - p.y[f[0]], uz = double(p.z[f[1]]) - p.z[f[0]];
+  double wx = double(p.x[f[2]]) - p.x[f[0]], wy = double(p.y[f[2]]) - p.y[f[0]], wz = double(p.z[f[2]]) - p.z[f[0]];
+  double nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+  return nx == 0 && ny == 0 && nz == 0;
+}
+
+// Degenerate faces and later copies of duplicated faces are marked in drop_
+void classify_faces(const IndexedMesh &mesh, vector<uint8_t> &drop_, MeshCheckReport &report_, unsigned threads)
+{
+  size_t triangles = mesh.triangle_count();
+  unsigned shards = parallel_chunks(triangles, threads) * kShardsPerThread;
+
+  // Step 1. degenerate faces
+  drop_.assign(triangles, 0);
+  parallel_for(triangles, [&](size_t begin, size_t end, unsigned) {
+    for (size_t t = begin; t < end; ++t) drop_[t] = is_degenerate(mesh, t);
+  }, threads);
+  report_.degenerate_faces = size_t(count(drop_.begin(), drop_.end(), 1));
+
+  // Step 2. duplicate faces: equal sorted corner triples end up next to each other
+  vector<FaceRecord> faces;
+  vector<size_t> start;
+  scatter_to_shards<FaceRecord>(triangles, shards, [&](size_t t, auto put) {
+    if (drop_[t]) return;
+    FaceRecord r{{mesh.indices[t * 3], mesh.indices[t * 3 + 1], mesh.indices[t * 3 + 2]}, uint32_t(t)};
+    sort(r.v, r.v + 3);
+    put(shard_of((uint64_t(r.v[0]) << 32 | r.v[1]) ^ (uint64_t(r.v[2]) * 0xc4ceb9fe1a85ec53ULL), shards), r);
+  }, faces, start, threads);
+
+  vector<size_t> duplicates(shards, 0);
+  parallel_for(shards, [&](size_t begin, size_t end, unsigned) {
+    for (size_t s = begin; s < end; ++s) {
+      auto first = faces.begin() + start[s], last = faces.begin() + start[s + 1];
+      sort(first, last);
+      for (auto f = first; f != last; ++f)
+        if (f != first && f->same_vertices(f[-1])) {
+          drop_[f->face] = 1; // shards are disjoint, so are the faces written here
+          ++duplicates[s];
+        }
+    }
+  }, threads, 1);
+  report_.duplicate_faces = accumulate(duplicates.begin(), duplicates.end(), size_t(0));
+}
+
+// Connected groups of boundary edges, by union-find over their vertices
+size_t count_loops(vector<uint64_t> &edges)
+{
+  vector<uint32_t> vertices;
+  vertices.reserve(edges.size() * 2);
+  for (uint64_t e : edges) {
+    vertices.push_back(uint32_t(e >> 32));
+    vertices.push_back(uint32_t(e));
+  }
+  sort(vertices.begin(), vertices.end());
+  vertices.erase(unique(vertices.begin(), vertices.end()), vertices.end());
+  auto id = [&](uint32_t v) { return uint32_t(lower_bound(vertices.begin(), vertices.end(), v) - vertices.begin()); };
+
+  vector<uint32_t> parent(vertices.size());
+  iota(parent.begin(), parent.end(), 0);
+  auto find = [&](uint32_t v) {
+    while (parent[v] != v) v = parent[v] = parent[parent[v]];
+    return v;
+  };
+  size_t groups = vertices.size();
+  for (uint64_t e : edges) {
+    uint32_t a = find(id(uint32_t(e >> 32))), b = find(id(uint32_t(e)));
+    if (a != b) {
+      parent[max(a, b)] = min(a, b);
+      --groups;
+    }
+  }
+  return groups;
+}
+
+} // namespace
+
+string MeshCheckReport::str() const
+{
+    ostringstream oss;
+    oss << triangles << " triangles, " << degenerate_faces << " degenerate, " << duplicate_faces << " duplicate, "
+        << non_manifold_edges << " non-manifold edges, " << inconsistent_edges << " inconsistently oriented edges, "
+        << boundary_edges << " boundary edges in " << boundary_loops << " loops";
+    return oss.str();
+}
+
+void check_mesh(const IndexedMesh &mesh, MeshCheckReport &report_, unsigned threads)
+{
+    report_ = MeshCheckReport();
+    size_t triangles = mesh.triangle_count();
+    report_.triangles = triangles;
+
+    vector<uint8_t> drop;
+    classify_faces(mesh, drop, report_, threads);
+
+    // Step 3. edges of the faces left, counted per edge
+    unsigned shards = parallel_chunks(triangles, threads) * kShardsPerThread;
+    vector<EdgeRecord> edges;
+    vector<size_t> start;
+    scatter_to_shards<EdgeRecord>(triangles, shards, [&](size_t t, auto put) {
+        if (drop[t]) return;
+        const uint32_t *f = &mesh.indices[t * 3];
+        for (int c = 0; c < 3; ++c) {
+            uint32_t a = f[c], b = f[(c + 1) % 3];
+            uint64_t key = uint64_t(min(a, b)) << 32 | max(a, b);
+            put(shard_of(key, shards), EdgeRecord{key, a < b});
+        }
+    }, edges, start, threads);
+
+    vector<MeshCheckReport> partial(shards);
+    vector<vector<uint64_t>> boundary(shards);
+    parallel_for(shards, [&](size_t begin, size_t end, unsigned) {
+        for (size_t s = begin; s < end; ++s) {
+            auto first = edges.begin() + start[s], last = edges.begin() + start[s + 1];
+            sort(first, last, [](const EdgeRecord &a, const EdgeRecord &b) { return a.key < b.key; });
+            for (auto e = first; e != last;) {
+                auto next = e + 1;
+                while (next != last && next->key == e->key) ++next;
+                size_t faces = size_t(next - e);
+                if (faces == 1) boundary[s].push_back(e->key);
+                else if (faces > 2) ++partial[s].non_manifold_edges;
+                else if (e[0].forward == e[1].forward) ++partial[s].inconsistent_edges;
+                e = next;
+            }
+        }
+    }, threads, 1);
+
+    vector<uint64_t> boundary_edges;
+    for (size_t s = 0; s < shards; ++s) {
+        report_.non_manifold_edges += partial[s].non_manifold_edges;
+        report_.inconsistent_edges += partial[s].inconsistent_edges;
+        boundary_edges.insert(boundary_edges.end(), boundary[s].begin(), boundary[s].end());
+    }
+    report_.boundary_edges = boundary_edges.size();
+    report_.boundary_loops = count_loops(boundary_edges);
+}
+
+size_t repair_mesh(IndexedMesh &mesh_, unsigned threads)
+{
+    vector<uint8_t> drop;
+    MeshCheckReport report;
+    classify_faces(mesh_, drop, report, threads);
+
+    size_t kept = 0;
+    for (size_t t = 0; t < drop.size(); ++t) {
+        if (drop[t]) continue;
+        if (kept != t) copy_n(&mesh_.indices[t * 3], 3, &mesh_.indices[kept * 3]);
+        ++kept;
+    }
+    mesh_.indices.resize(kept * 3);
+    return drop.size() - kept;
+}
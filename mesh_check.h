@@ -0,0 +1,30 @@
+#ifndef DA_SEG_MESH_CHECK_H
+#define DA_SEG_MESH_CHECK_H
+
+#include <string>
+
+#include "mesh.h"
+
+struct MeshCheckReport {
+    size_t triangles = 0;
+    size_t degenerate_faces = 0;     // repeated corner or zero area
+    size_t duplicate_faces = 0;      // extra copies of a face with the same three vertices
+    size_t non_manifold_edges = 0;   // edges shared by more than two faces
+    size_t inconsistent_edges = 0;   // edges both of whose faces run the same way
+    size_t boundary_edges = 0;       // edges with one face: holes and the scan border
+    size_t boundary_loops = 0;       // connected groups of boundary edges
+
+    // degenerate or duplicate faces, or non-manifold edges
+    bool has_defects() const { return degenerate_faces > 0 || duplicate_faces > 0 || non_manifold_edges > 0; }
+    std::string str() const;
+};
+
+// Topology and geometry checks in one parallel pass. Edges and faces are
+// hashed into shards, and each shard is sorted on its own.
+void check_mesh(const IndexedMesh &mesh, MeshCheckReport &report_, unsigned threads = 0);
+
+// Drops degenerate faces and all but the first copy of duplicated faces.
+// Returns the number of faces dropped. Vertices are kept as they are.
+size_t repair_mesh(IndexedMesh &mesh_, unsigned threads = 0);
+
+#endif // DA_SEG_MESH_CHECK_H
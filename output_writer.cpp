@@ -0,0 +1,328 @@
+#include "output_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+
+#ifdef SEG_HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// one batch: at most this many files, and it stops taking files past this many bytes
+const size_t kBatchFiles = 64;
+const size_t kBatchBytes = size_t(32) << 20;
+// larger files are written with pwrite even when there is a ring
+const size_t kMaxRingWrite = size_t(1) << 30;
+
+bool pwrite_all(int fd, const char *p, size_t size, off_t offset)
+{
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    size -= size_t(n);
+    offset += n;
+  }
+  return true;
+}
+
+string directory_of(const string &path)
+{
+  string dir = fs::path(path).parent_path().string();
+  return dir.empty() ? "." : dir;
+}
+
+// Per file progress through one batch
+struct Pending {
+  int fd = -1;
+  size_t written = 0;
+  bool synced = false;
+  int error = 0; // errno of the first failure
+};
+
+void *make_ring()
+{
+#ifdef SEG_HAVE_IO_URING
+  auto *ring = new io_uring;
+  // a write and an fsync per file of a full batch
+  if (io_uring_queue_init(unsigned(kBatchFiles * 2), ring, 0) == 0) return ring;
+  delete ring;
+#endif
+  return nullptr;
+}
+
+void free_ring(void *ring)
+{
+#ifdef SEG_HAVE_IO_URING
+  if (ring) {
+    io_uring_queue_exit(static_cast<io_uring *>(ring));
+    delete static_cast<io_uring *>(ring);
+  }
+#else
+  (void)ring;
+#endif
+}
+
+// Queues a write linked to an fdatasync for every file, submits them all at
+// once and reaps the completions. Short writes and syncs cancelled behind them
+// are left for the caller to finish. Returns false if the ring can no longer
+// be used.
+bool ring_write(void *ring_ptr, const vector<pair<string, string>> &files, vector<Pending> &pending_)
+{
+#ifdef SEG_HAVE_IO_URING
+  io_uring *ring = static_cast<io_uring *>(ring_ptr);
+  unsigned queued = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const string &data = files[i].second;
+    if (pending_[i].fd < 0 || data.size() > kMaxRingWrite) continue;
+    io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    io_uring_prep_write(sqe, pending_[i].fd, data.data(), unsigned(data.size()), 0);
+    sqe->flags |= IOSQE_IO_LINK;
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(uintptr_t(i * 2)));
+    sqe = io_uring_get_sqe(ring);
+    io_uring_prep_fsync(sqe, pending_[i].fd, IORING_FSYNC_DATASYNC);
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(uintptr_t(i * 2 + 1)));
+    queued += 2;
+  }
+
+  unsigned submitted = 0;
+  bool usable = true;
+  while (submitted < queued) {
+    int n = io_uring_submit(ring);
+    if (n == -EINTR) continue;
+    if (n <= 0) {
+      // entries never submitted stay in the ring, so it is not used again
+      usable = false;
+      break;
+    }
+    submitted += unsigned(n);
+  }
+
+  for (unsigned k = 0; k < submitted; ++k) {
+    io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(ring, &cqe);
+    if (ret == -EINTR) {
+      --k;
+      continue;
+    }
+    if (ret < 0) return false;
+    uintptr_t tag = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+    Pending &p = pending_[tag / 2];
+    int res = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    if (res == -ECANCELED) continue;
+    if (res < 0) {
+      if (!p.error) p.error = -res;
+    } else if (tag % 2 == 0) {
+      p.written = size_t(res);
+    } else {
+      p.synced = true;
+    }
+  }
+  return usable;
+#else
+  (void)ring_ptr;
+  (void)files;
+  (void)pending_;
+  return false;
+#endif
+}
+
+} // namespace
+
+OutputWriter::OutputWriter(unsigned threads, size_t max_queued_bytes)
+    : max_queued_bytes_(max_queued_bytes)
+{
+    threads = max(threads, 1u);
+    vector<void *> rings;
+    for (unsigned i = 0; i < threads; ++i) {
+        void *ring = make_ring();
+        if (!ring) break;
+        rings.push_back(ring);
+    }
+    // all or nothing, so backend() tells the truth
+    uring_ = rings.size() == threads;
+    if (!uring_) {
+        for (void *ring : rings) free_ring(ring);
+        rings.assign(threads, nullptr);
+    }
+    for (void *ring : rings) threads_.emplace_back(&OutputWriter::writer_loop, this, ring);
+}
+
+OutputWriter::~OutputWriter()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &t : threads_) t.join();
+}
+
+const char *OutputWriter::backend() const
+{
+    return uring_ ? "io_uring" : "threads";
+}
+
+void OutputWriter::write(const string &path, string data)
+{
+    unique_lock<mutex> lock(mutex_);
+    // a single buffer larger than the budget still goes through, alone
+    space_cv_.wait(lock, [&] { return queued_bytes_ == 0 || queued_bytes_ + data.size() <= max_queued_bytes_; });
+
+    auto it = queued_.find(path);
+    if (it != queued_.end()) {
+        queued_bytes_ -= it->second.size();
+        ++stats_.coalesced;
+    } else {
+        order_.push_back(path);
+    }
+    queued_bytes_ += data.size();
+    queued_[path] = move(data);
+    lock.unlock();
+    work_cv_.notify_one();
+}
+
+bool OutputWriter::flush(string &error_msg_)
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_cv_.wait(lock, [&] { return order_.empty() && busy_ == 0; });
+    if (errors_.empty()) return true;
+
+    error_msg_ = to_string(errors_.size()) + " output file(s) not written: " + errors_.front();
+    if (errors_.size() > 1) error_msg_ += ", ...";
+    errors_.clear();
+    return false;
+}
+
+OutputWriterStats OutputWriter::stats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void OutputWriter::print_stats(ostream &os) const
+{
+    OutputWriterStats s = stats();
+    os << "output (" << backend() << "): " << s.files << " files, " << s.bytes << " bytes in " << s.batches
+       << " batches, " << s.coalesced << " coalesced, " << s.failed << " failed" << endl;
+}
+
+void OutputWriter::writer_loop(void *ring)
+{
+    void *own_ring = ring;
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+        // a path another thread is still writing waits, so renames keep their order
+        auto ready = [&] {
+            return any_of(order_.begin(), order_.end(), [&](const string &p) { return !in_flight_.count(p); });
+        };
+        work_cv_.wait(lock, [&] { return ready() || (stop_ && order_.empty()); });
+        if (order_.empty()) break;
+
+        // Step 1. take the oldest files that are not being written already
+        vector<pair<string, string>> batch;
+        size_t bytes = 0;
+        for (auto it = order_.begin(); it != order_.end() && batch.size() < kBatchFiles && bytes < kBatchBytes;) {
+            if (in_flight_.count(*it)) {
+                ++it;
+                continue;
+            }
+            auto q = queued_.find(*it);
+            bytes += q->second.size();
+            batch.emplace_back(*it, move(q->second));
+            in_flight_.insert(*it);
+            queued_.erase(q);
+            it = order_.erase(it);
+        }
+        ++busy_;
+        lock.unlock();
+
+        vector<string> errors;
+        if (!write_batch(batch, ring, errors)) ring = nullptr;
+
+        lock.lock();
+        --busy_;
+        for (const auto &f : batch) in_flight_.erase(f.first);
+        queued_bytes_ -= bytes;
+        ++stats_.batches;
+        stats_.files += batch.size() - errors.size();
+        stats_.bytes += bytes;
+        stats_.failed += errors.size();
+        errors_.insert(errors_.end(), errors.begin(), errors.end());
+        space_cv_.notify_all();
+        work_cv_.notify_all();
+        if (order_.empty() && busy_ == 0) idle_cv_.notify_all();
+    }
+    lock.unlock();
+    free_ring(own_ring);
+}
+
+bool OutputWriter::write_batch(const vector<pair<string, string>> &batch, void *ring, vector<string> &errors_)
+{
+    vector<Pending> pending(batch.size());
+
+    // Step 2. open the temporary files
+    for (size_t i = 0; i < batch.size(); ++i) {
+        string tmp = batch[i].first + ".tmp";
+        pending[i].fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (pending[i].fd < 0) pending[i].error = errno;
+    }
+
+    // Step 3. write and sync: one submission on the ring, then whatever it
+    // left over, or everything without one. All writes go out before the first
+    // sync, so the file system can flush them together.
+    bool usable = ring && ring_write(ring, batch, pending);
+    for (size_t i = 0; i < batch.size(); ++i) {
+        Pending &p = pending[i];
+        const string &data = batch[i].second;
+        if (p.fd < 0 || p.error || p.written == data.size()) continue;
+        if (!pwrite_all(p.fd, data.data() + p.written, data.size() - p.written, off_t(p.written))) p.error = errno;
+        else p.written = data.size();
+    }
+    for (auto &p : pending) {
+        if (p.fd < 0 || p.error || p.synced) continue;
+        if (fdatasync(p.fd) != 0) p.error = errno;
+        else p.synced = true;
+    }
+
+    // Step 4. rename into place, then make the renames durable once per directory
+    map<string, vector<string>> directories;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        Pending &p = pending[i];
+        const string &path = batch[i].first;
+        string tmp = path + ".tmp";
+        if (p.fd >= 0 && close(p.fd) != 0 && !p.error) p.error = errno;
+        if (!p.error && rename(tmp.c_str(), path.c_str()) != 0) p.error = errno;
+        if (p.error) {
+            errors_.push_back("'" + path + "': " + strerror(p.error));
+            if (p.fd >= 0) unlink(tmp.c_str());
+            continue;
+        }
+        directories[directory_of(path)].push_back(path);
+    }
+    // an unsynced rename may not survive a crash, so each file in the
+    // directory counts as failed
+    for (const auto &dir : directories) {
+        int fd = ::open(dir.first.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int error = (fd < 0 || fsync(fd) != 0) ? errno : 0;
+        if (fd >= 0) close(fd);
+        if (!error) continue;
+        for (const auto &path : dir.second)
+            errors_.push_back("'" + path + "': directory sync failed: " + strerror(error));
+    }
+    return usable;
+}
@@ -0,0 +1,85 @@
+#ifndef DA_SEG_OUTPUT_WRITER_H
+#define DA_SEG_OUTPUT_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct OutputWriterStats {
+    size_t files = 0;       // renamed into place
+    size_t bytes = 0;
+    size_t batches = 0;
+    size_t coalesced = 0;   // writes replaced by a later write of the same path before reaching disk
+    size_t failed = 0;
+};
+
+// Writes whole result files off the calling thread, so workers hand over a
+// buffer and go back to the network.
+//
+// write() only queues the buffer. Writer threads take the queue in batches:
+// every file of a batch is written to PATH.tmp, the batch is fdatasync'ed
+// together, each file is renamed over PATH and each directory is synced once.
+// A result file is therefore either missing or complete, never torn. A path
+// written again while still queued only reaches the disk once, with the last
+// contents.
+//
+// Built with SEG_HAVE_IO_URING, the writes and syncs of a batch go to the
+// kernel in a single io_uring submission per thread; otherwise, or when the
+// ring cannot be set up, they are plain pwrite/fdatasync calls.
+// This is a thread-safe class.
+class OutputWriter {
+public:
+    // write() blocks while more than max_queued_bytes wait for the disk
+    explicit OutputWriter(unsigned threads = 2, size_t max_queued_bytes = size_t(256) << 20);
+    // Writes everything still queued, then joins the threads.
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    void write(const std::string &path, std::string data);
+
+    // Blocks until everything written so far is renamed into place. Fails with
+    // the files that could not be written since the last flush().
+    bool flush(std::string &error_msg_);
+
+    // "io_uring" or "threads"
+    const char *backend() const;
+
+    OutputWriterStats stats() const;
+    void print_stats(std::ostream &os) const;
+
+private:
+    // ring is null without io_uring; returns false once the ring is unusable
+    void writer_loop(void *ring);
+    bool write_batch(const std::vector<std::pair<std::string, std::string>> &batch, void *ring,
+                     std::vector<std::string> &errors_);
+
+    size_t max_queued_bytes_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<std::string> order_;                      // queued paths, oldest first
+    std::unordered_map<std::string, std::string> queued_; // path -> latest contents
+    std::set<std::string> in_flight_;                    // paths some thread is writing
+    size_t queued_bytes_ = 0;
+    size_t busy_ = 0;
+    bool stop_ = false;
+    bool uring_ = false;
+    std::vector<std::string> errors_;
+    OutputWriterStats stats_;
+
+    std::vector<std::thread> threads_;
+};
+
+#endif // DA_SEG_OUTPUT_WRITER_H
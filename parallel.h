@@ -0,0 +1,53 @@
+#ifndef DA_SEG_PARALLEL_H
+#define DA_SEG_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "memory_stats.h"
+
+inline unsigned default_threads()
+{
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 4;
+}
+
+// Splits [0, n) into one contiguous range per thread and runs f(begin, end, thread_index).
+// Small inputs run inline, threads are not worth it below min_chunk items each.
+// The threads charge their allocations to the caller's MemoryArena.
+template <typename F>
+void parallel_for(size_t n, F f, unsigned threads = 0, size_t min_chunk = 4096)
+{
+  if (threads == 0) threads = default_threads();
+  size_t chunks = std::min<size_t>(threads, (n + min_chunk - 1) / min_chunk);
+  if (chunks <= 1) {
+    if (n > 0) f(size_t(0), n, 0u);
+    return;
+  }
+
+  MemoryArena *arena = current_memory_arena();
+  std::vector<std::thread> pool;
+  pool.reserve(chunks - 1);
+  size_t step = (n + chunks - 1) / chunks;
+  for (size_t c = 1; c < chunks; ++c) {
+    size_t begin = std::min(n, c * step), end = std::min(n, begin + step);
+    pool.emplace_back([=, &f] {
+      MemoryScope scope(arena);
+      f(begin, end, unsigned(c));
+    });
+  }
+  f(size_t(0), std::min(n, step), 0u);
+  for (auto &t : pool) t.join();
+}
+
+// Number of ranges parallel_for will use, to size per-thread buffers
+inline unsigned parallel_chunks(size_t n, unsigned threads = 0, size_t min_chunk = 4096)
+{
+  if (threads == 0) threads = default_threads();
+  size_t chunks = std::min<size_t>(threads, (n + min_chunk - 1) / min_chunk);
+  return chunks ? unsigned(chunks) : 1u;
+}
+
+#endif // DA_SEG_PARALLEL_H
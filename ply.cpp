@@ -0,0 +1,428 @@
+#include "ply.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+struct ScalarType {
+  int size = 0;
+  char kind = 0; // 'i' signed, 'u' unsigned, 'f' floating point
+};
+
+struct Property {
+  string name;
+  ScalarType type;   // the item type for lists
+  bool is_list = false;
+  ScalarType count;  // lists only
+};
+
+struct Element {
+  string name;
+  size_t count = 0;
+  vector<Property> properties;
+
+  bool has_list() const
+  {
+    for (const auto &p : properties)
+      if (p.is_list) return true;
+    return false;
+  }
+  size_t stride() const
+  {
+    size_t s = 0;
+    for (const auto &p : properties) s += size_t(p.type.size);
+    return s;
+  }
+};
+
+bool parse_type(const string &name, ScalarType &type_)
+{
+  static const struct {
+    const char *name;
+    int size;
+    char kind;
+  } types[] = {{"char", 1, 'i'},   {"int8", 1, 'i'},   {"uchar", 1, 'u'},   {"uint8", 1, 'u'},
+               {"short", 2, 'i'},  {"int16", 2, 'i'},  {"ushort", 2, 'u'},  {"uint16", 2, 'u'},
+               {"int", 4, 'i'},    {"int32", 4, 'i'},  {"uint", 4, 'u'},    {"uint32", 4, 'u'},
+               {"float", 4, 'f'},  {"float32", 4, 'f'}, {"double", 8, 'f'}, {"float64", 8, 'f'}};
+  for (const auto &t : types)
+    if (name == t.name) {
+      type_.size = t.size;
+      type_.kind = t.kind;
+      return true;
+    }
+  return false;
+}
+
+inline double read_double(const char *p, ScalarType t)
+{
+  switch (t.kind * 16 + t.size) {
+  case 'f' * 16 + 4: { float v; memcpy(&v, p, 4); return v; }
+  case 'f' * 16 + 8: { double v; memcpy(&v, p, 8); return v; }
+  case 'i' * 16 + 1: return int8_t(*p);
+  case 'u' * 16 + 1: return uint8_t(*p);
+  case 'i' * 16 + 2: { int16_t v; memcpy(&v, p, 2); return v; }
+  case 'u' * 16 + 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+  case 'i' * 16 + 4: { int32_t v; memcpy(&v, p, 4); return v; }
+  default: { uint32_t v; memcpy(&v, p, 4); return v; }
+  }
+}
+
+inline int64_t read_int(const char *p, ScalarType t)
+{
+  if (t.kind == 'f') return int64_t(read_double(p, t));
+  switch (t.kind * 16 + t.size) {
+  case 'i' * 16 + 1: return int8_t(*p);
+  case 'u' * 16 + 1: return uint8_t(*p);
+  case 'i' * 16 + 2: { int16_t v; memcpy(&v, p, 2); return v; }
+  case 'u' * 16 + 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+  case 'i' * 16 + 4: { int32_t v; memcpy(&v, p, 4); return v; }
+  default: { uint32_t v; memcpy(&v, p, 4); return v; }
+  }
+}
+
+bool parse_header(const string &data, vector<Element> &elements_, size_t &body_, string &error_msg_)
+{
+  size_t end = data.find("end_header");
+  if (end == string::npos) {
+    error_msg_ = "PLY header has no end_header";
+    return false;
+  }
+  body_ = data.find('\n', end);
+  if (body_ == string::npos) {
+    error_msg_ = "PLY header has no end_header";
+    return false;
+  }
+  ++body_;
+
+  istringstream header(data.substr(0, end));
+  string line;
+  while (getline(header, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    istringstream words(line);
+    string keyword;
+    words >> keyword;
+    if (keyword == "format") {
+      string format;
+      words >> format;
+      if (format != "binary_little_endian") {
+        error_msg_ = "unsupported PLY format '" + format + "', only binary_little_endian is read";
+        return false;
+      }
+    } else if (keyword == "element") {
+      Element e;
+      words >> e.name >> e.count;
+      elements_.push_back(e);
+    } else if (keyword == "property") {
+      if (elements_.empty()) {
+        error_msg_ = "PLY property before any element";
+        return false;
+      }
+      Property p;
+      string type;
+      words >> type;
+      if (type == "list") {
+        string count_type;
+        p.is_list = true;
+        words >> count_type >> type;
+        if (!parse_type(count_type, p.count) || p.count.kind == 'f') {
+          error_msg_ = "bad PLY list count type '" + count_type + "'";
+          return false;
+        }
+      }
+      if (!parse_type(type, p.type)) {
+        error_msg_ = "unknown PLY property type '" + type + "'";
+        return false;
+      }
+      words >> p.name;
+      elements_.back().properties.push_back(p);
+    }
+  }
+  return true;
+}
+
+// Walks one record of an element with list properties. on_list(property, n, items)
+// is called for every list. Returns the position after the record, or nullptr
+// if the record runs past end.
+template <typename OnList>
+const char *walk_record(const Element &e, const char *p, const char *end, OnList on_list)
+{
+  for (const auto &prop : e.properties) {
+    if (!prop.is_list) {
+      p += prop.type.size;
+      continue;
+    }
+    if (p + prop.count.size > end) return nullptr;
+    int64_t n = read_int(p, prop.count);
+    p += prop.count.size;
+    if (n < 0 || n > (end - p) / prop.type.size) return nullptr;
+    on_list(prop, size_t(n), p);
+    p += n * prop.type.size;
+  }
+  return p <= end ? p : nullptr;
+}
+
+bool read_vertices(const Element &e, const char *p, const char *end, IndexedMesh &mesh_, vector<int> *labels_,
+                   string &error_msg_, unsigned threads)
+{
+  size_t stride = e.stride();
+  if (e.count > size_t(end - p) / max<size_t>(stride, 1)) {
+    error_msg_ = "PLY vertex data is truncated";
+    return false;
+  }
+
+  int offset[4] = {-1, -1, -1, -1}; // x, y, z, label
+  ScalarType type[4];
+  const char *names[4] = {"x", "y", "z", "label"};
+  int at = 0;
+  for (const auto &prop : e.properties) {
+    for (int k = 0; k < 4; ++k)
+      if (prop.name == names[k]) {
+        offset[k] = at;
+        type[k] = prop.type;
+      }
+    at += prop.type.size;
+  }
+  if (offset[0] < 0 || offset[1] < 0 || offset[2] < 0) {
+    error_msg_ = "PLY vertices have no x, y, z";
+    return false;
+  }
+
+  Vertices &v = mesh_.vertices;
+  v.resize(e.count);
+  bool with_labels = labels_ && offset[3] >= 0;
+  if (labels_) labels_->assign(with_labels ? e.count : 0, 0);
+  float *axes[3] = {v.x.data(), v.y.data(), v.z.data()};
+  parallel_for(e.count, [&](size_t begin, size_t last, unsigned) {
+    for (size_t i = begin; i < last; ++i) {
+      const char *r = p + i * stride;
+      for (int k = 0; k < 3; ++k) {
+        if (type[k].kind == 'f' && type[k].size == 4) memcpy(&axes[k][i], r + offset[k], 4);
+        else axes[k][i] = float(read_double(r + offset[k], type[k]));
+      }
+      if (with_labels) (*labels_)[i] = int(read_int(r + offset[3], type[3]));
+    }
+  }, threads);
+  return true;
+}
+
+// Record sizes and header of the layout write_ply produces
+const size_t kFaceSize = 13;
+const size_t kRecordsPerBlock = 1 << 14;
+
+string ply_header(size_t vertices, size_t triangles, bool with_labels)
+{
+  string header = "ply\nformat binary_little_endian 1.0\nelement vertex " + to_string(vertices) +
+                  "\nproperty float x\nproperty float y\nproperty float z\n";
+  if (with_labels) header += "property int label\n";
+  header += "element face " + to_string(triangles) + "\nproperty list uchar int vertex_indices\nend_header\n";
+  return header;
+}
+
+inline void put_vertex(char *r, const Vertices &v, size_t i, const vector<int> *labels)
+{
+  memcpy(r, &v.x[i], 4);
+  memcpy(r + 4, &v.y[i], 4);
+  memcpy(r + 8, &v.z[i], 4);
+  if (labels) memcpy(r + 12, &(*labels)[i], 4);
+}
+
+inline void put_face(char *r, const IndexedMesh &mesh, size_t t)
+{
+  r[0] = 3;
+  memcpy(r + 1, &mesh.indices[t * 3], 12);
+}
+
+bool is_index_list(const Property &p)
+{
+  return p.is_list && (p.name == "vertex_indices" || p.name == "vertex_index") && p.type.kind != 'f';
+}
+
+bool read_faces(const Element &e, const char *&p, const char *end, IndexedMesh &mesh_, string &error_msg_,
+                unsigned threads)
+{
+  vector<uint32_t> &indices = mesh_.indices;
+
+  // fast path: the index list is the only property and every face a triangle,
+  // so the records have a fixed size
+  const Property &first = e.properties.front();
+  if (e.properties.size() == 1 && is_index_list(first) && first.type.size == 4) {
+    size_t stride = size_t(first.count.size) + 12;
+    if (e.count <= size_t(end - p) / stride) {
+      indices.resize(e.count * 3);
+      atomic<bool> triangles(true);
+      parallel_for(e.count, [&](size_t begin, size_t last, unsigned) {
+        for (size_t t = begin; t < last; ++t) {
+          const char *r = p + t * stride;
+          if (read_int(r, first.count) != 3) {
+            triangles = false;
+            return;
+          }
+          memcpy(&indices[t * 3], r + first.count.size, 12);
+        }
+      }, threads);
+      if (triangles) {
+        p += e.count * stride;
+        return true;
+      }
+    }
+  }
+
+  // general path: polygons, other properties, other index types
+  indices.clear();
+  indices.reserve(e.count * 3);
+  for (size_t t = 0; t < e.count; ++t) {
+    p = walk_record(e, p, end, [&](const Property &prop, size_t n, const char *items) {
+      if (!is_index_list(prop)) return;
+      for (size_t k = 2; k < n; ++k) {
+        indices.push_back(uint32_t(read_int(items, prop.type)));
+        indices.push_back(uint32_t(read_int(items + (k - 1) * prop.type.size, prop.type)));
+        indices.push_back(uint32_t(read_int(items + k * prop.type.size, prop.type)));
+      }
+    });
+    if (!p) {
+      error_msg_ = "PLY face data is truncated";
+      return false;
+    }
+  }
+  return true;
+}
+
+// One label per vertex, when there are labels
+bool labels_match(const IndexedMesh &mesh, const vector<int> *labels, string &error_msg_)
+{
+  if (!labels || labels->size() == mesh.vertices.size()) return true;
+  error_msg_ = "label count " + to_string(labels->size()) + " does not match vertex count " +
+               to_string(mesh.vertices.size());
+  return false;
+}
+
+// labels must match, see labels_match
+void encode_ply(const IndexedMesh &mesh, string &data_, const vector<int> *labels, unsigned threads)
+{
+  size_t n = mesh.vertices.size(), triangles = mesh.triangle_count();
+  string header = ply_header(n, triangles, labels != nullptr);
+  size_t vertex_size = labels ? 16 : 12;
+  size_t faces_at = header.size() + n * vertex_size;
+  data_.assign(faces_at + triangles * kFaceSize, '\0');
+  memcpy(&data_[0], header.data(), header.size());
+
+  parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; ++i) put_vertex(&data_[header.size() + i * vertex_size], mesh.vertices, i, labels);
+  }, threads);
+  parallel_for(triangles, [&](size_t begin, size_t end, unsigned) {
+    for (size_t t = begin; t < end; ++t) put_face(&data_[faces_at + t * kFaceSize], mesh, t);
+  }, threads);
+}
+
+} // namespace
+
+bool is_ply(const string &data)
+{
+    return data.compare(0, 4, "ply\n") == 0 || data.compare(0, 5, "ply\r\n") == 0;
+}
+
+bool read_ply(const string &data, IndexedMesh &mesh_, vector<int> *labels_, string &error_msg_, unsigned threads)
+{
+    if (!is_ply(data)) {
+        error_msg_ = "not a PLY file";
+        return false;
+    }
+    vector<Element> elements;
+    size_t body;
+    if (!parse_header(data, elements, body, error_msg_)) return false;
+
+    mesh_ = IndexedMesh();
+    if (labels_) labels_->clear();
+    const char *p = data.data() + body, *end = data.data() + data.size();
+    bool have_vertices = false, have_faces = false;
+    for (const auto &e : elements) {
+        if (e.name == "vertex" && !have_vertices) {
+            if (e.has_list()) {
+                error_msg_ = "PLY vertices with list properties are not supported";
+                return false;
+            }
+            if (!read_vertices(e, p, end, mesh_, labels_, error_msg_, threads)) return false;
+            p += e.count * e.stride();
+            have_vertices = true;
+        } else if (e.name == "face" && !have_faces && !e.properties.empty()) {
+            if (!read_faces(e, p, end, mesh_, error_msg_, threads)) return false;
+            have_faces = true;
+        } else if (!e.has_list()) {
+            if (e.count > size_t(end - p) / max<size_t>(e.stride(), 1)) {
+                error_msg_ = "PLY element '" + e.name + "' is truncated";
+                return false;
+            }
+            p += e.count * e.stride();
+        } else {
+            for (size_t i = 0; i < e.count && p; ++i) p = walk_record(e, p, end, [](const Property &, size_t, const char *) {});
+            if (!p) {
+                error_msg_ = "PLY element '" + e.name + "' is truncated";
+                return false;
+            }
+        }
+        if (have_vertices && have_faces) break;
+    }
+    if (!have_vertices) {
+        error_msg_ = "PLY has no vertex element";
+        return false;
+    }
+
+    size_t n = mesh_.vertices.size();
+    atomic<bool> in_range(true);
+    parallel_for(mesh_.indices.size(), [&](size_t begin, size_t last, unsigned) {
+        for (size_t i = begin; i < last; ++i)
+            if (mesh_.indices[i] >= n) in_range = false;
+    }, threads);
+    if (!in_range) {
+        error_msg_ = "PLY face refers to a vertex that does not exist";
+        return false;
+    }
+    return true;
+}
+
+void write_ply(const IndexedMesh &mesh, string &data_, unsigned threads)
+{
+    encode_ply(mesh, data_, nullptr, threads);
+}
+
+bool write_ply(const IndexedMesh &mesh, string &data_, const vector<int> &labels, string &error_msg_, unsigned threads)
+{
+    if (!labels_match(mesh, &labels, error_msg_)) return false;
+    encode_ply(mesh, data_, &labels, threads);
+    return true;
+}
+
+bool write_ply(ostream &out, const IndexedMesh &mesh, const vector<int> *labels, string &error_msg_)
+{
+    size_t n = mesh.vertices.size(), triangles = mesh.triangle_count();
+    if (!labels_match(mesh, labels, error_msg_)) return false;
+
+    string header = ply_header(n, triangles, labels != nullptr);
+    out.write(header.data(), streamsize(header.size()));
+
+    size_t vertex_size = labels ? 16 : 12;
+    vector<char> block(kRecordsPerBlock * max(vertex_size, kFaceSize));
+    for (size_t begin = 0; begin < n && out; begin += kRecordsPerBlock) {
+        size_t end = min(n, begin + kRecordsPerBlock);
+        for (size_t i = begin; i < end; ++i) put_vertex(&block[(i - begin) * vertex_size], mesh.vertices, i, labels);
+        out.write(block.data(), streamsize((end - begin) * vertex_size));
+    }
+    for (size_t begin = 0; begin < triangles && out; begin += kRecordsPerBlock) {
+        size_t end = min(triangles, begin + kRecordsPerBlock);
+        for (size_t t = begin; t < end; ++t) put_face(&block[(t - begin) * kFaceSize], mesh, t);
+        out.write(block.data(), streamsize((end - begin) * kFaceSize));
+    }
+
+    if (!out) {
+        error_msg_ = "failed to write PLY";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef DA_SEG_PLY_H
+#define DA_SEG_PLY_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+// True when data starts with a PLY header
+bool is_ply(const std::string &data);
+
+// Parses a binary little-endian PLY straight out of data: fixed-size vertex
+// and triangle records are decoded in place, in parallel. Polygons are split
+// into triangle fans. Vertex properties other than x, y, z and label are
+// skipped; labels_ may be null, and is left empty when there is no label
+// property.
+bool read_ply(const std::string &data, IndexedMesh &mesh_, std::vector<int> *labels_, std::string &error_msg_,
+              unsigned threads = 0);
+
+// Binary little-endian PLY: float x, y, z per vertex and uchar/int index
+// lists for the triangles
+void write_ply(const IndexedMesh &mesh, std::string &data_, unsigned threads = 0);
+
+// Same, plus an int label per vertex. Fails if labels does not have one label
+// per vertex.
+bool write_ply(const IndexedMesh &mesh, std::string &data_, const std::vector<int> &labels, std::string &error_msg_,
+               unsigned threads = 0);
+
+// Same layout, streamed to out a block of records at a time, so the file is
+// never held in memory. Fails if labels does not have one label per vertex.
+bool write_ply(std::ostream &out, const IndexedMesh &mesh, const std::vector<int> *labels, std::string &error_msg_);
+
+#endif // DA_SEG_PLY_H
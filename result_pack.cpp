@@ -0,0 +1,310 @@
+#include "result_pack.h"
+#include "hash.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const char kRecordMagic[4] = {'Q', 'R', 'E', 'C'};
+const char kIndexMagic[4] = {'Q', 'I', 'D', 'X'};
+const uint32_t kIndexVersion = 1;
+const size_t kRecordHeader = 24;
+const size_t kIndexHeader = 24;
+const size_t kSlotSize = 24;
+
+// 0 marks an empty index slot
+uint64_t id_hash(const char *id, size_t len)
+{
+  uint64_t h = hash_bytes(id, len);
+  return h == 0 ? 1 : h;
+}
+
+uint64_t record_checksum(const char *id, size_t id_len, const char *payload, size_t payload_len)
+{
+  return hash_bytes(payload, payload_len, hash_bytes(id, id_len));
+}
+
+bool pwrite_all(int fd, const char *p, size_t left, uint64_t offset)
+{
+  while (left > 0) {
+    ssize_t n = pwrite(fd, p, left, off_t(offset));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    left -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// A complete record at offset whose checksum matches: its id and length
+bool read_record(const char *data, uint64_t size, uint64_t offset, string &id_, uint64_t &length_)
+{
+  if (offset + kRecordHeader > size || memcmp(data + offset, kRecordMagic, 4) != 0) return false;
+  uint32_t id_len;
+  uint64_t payload_len, checksum;
+  memcpy(&id_len, data + offset + 4, 4);
+  memcpy(&payload_len, data + offset + 8, 8);
+  memcpy(&checksum, data + offset + 16, 8);
+  if (payload_len > size || offset + kRecordHeader + id_len + payload_len > size) return false;
+
+  const char *id = data + offset + kRecordHeader;
+  if (record_checksum(id, id_len, id + id_len, payload_len) != checksum) return false;
+  id_.assign(id, id_len);
+  length_ = kRecordHeader + id_len + payload_len;
+  return true;
+}
+
+// Offset of the next intact record after a damaged one at offset, or size
+uint64_t next_record(const char *data, uint64_t size, uint64_t offset)
+{
+  string id;
+  uint64_t length;
+  for (uint64_t at = offset + 1; at + kRecordHeader <= size; ++at) {
+    const void *magic = memmem(data + at, size_t(size - at), kRecordMagic, 4);
+    if (!magic) break;
+    at = uint64_t(static_cast<const char *>(magic) - data);
+    if (read_record(data, size, at, id, length)) return at;
+  }
+  return size;
+}
+
+bool map_file(const string &path, const char *&data_, size_t &size_, string &error_msg_)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error_msg_ = "Could not open the file - '" + path + "': " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    error_msg_ = "Could not stat the file - '" + path + "': " + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  size_ = size_t(st.st_size);
+  data_ = nullptr;
+  if (size_ > 0) {
+    void *p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      error_msg_ = "Could not map the file - '" + path + "': " + strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    data_ = static_cast<const char *>(p);
+  }
+  ::close(fd);
+  return true;
+}
+
+} // namespace
+
+ResultPackWriter::ResultPackWriter(const string &path) : path_(path) {}
+
+ResultPackWriter::~ResultPackWriter()
+{
+    if (fd_ >= 0) ::close(fd_);
+    Entry *e = entries_.load();
+    while (e) {
+        Entry *next = e->next;
+        delete e;
+        e = next;
+    }
+}
+
+bool ResultPackWriter::open(string &error_msg_)
+{
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        error_msg_ = "Could not open the pack - '" + path_ + "': " + strerror(errno);
+        return false;
+    }
+    const char *data;
+    size_t mapped;
+    if (!map_file(path_, data, mapped, error_msg_)) return false;
+
+    // Step 1. re-index the intact records of earlier runs. Appenders write
+    // their reserved ranges concurrently, so a crash can leave a hole or a
+    // torn record with complete records after it; those are found again by
+    // their magic and checksum.
+    uint64_t size = mapped, offset = 0, end = 0;
+    while (offset < size) {
+        string id;
+        uint64_t length;
+        if (read_record(data, size, offset, id, length)) {
+            uint64_t h = id_hash(id.data(), id.size());
+            push(new Entry{move(id), h, offset, length, nullptr});
+            offset += length;
+            end = offset;
+            continue;
+        }
+        uint64_t next = next_record(data, size, offset);
+        if (next == size) break;
+        fprintf(stderr, "pack %s: skipping %llu damaged bytes at offset %llu\n", path_.c_str(),
+                (unsigned long long)(next - offset), (unsigned long long)offset);
+        offset = next;
+    }
+    if (data) munmap(const_cast<char *>(data), mapped);
+
+    // Step 2. drop a torn tail, new records go right after the last good one
+    if (end < size) {
+        fprintf(stderr, "pack %s: dropping %llu bytes after the last complete record\n", path_.c_str(),
+                (unsigned long long)(size - end));
+        if (ftruncate(fd_, off_t(end)) != 0) {
+            error_msg_ = "Could not truncate the pack - '" + path_ + "': " + strerror(errno);
+            return false;
+        }
+    }
+    end_ = end;
+    return true;
+}
+
+void ResultPackWriter::push(Entry *entry)
+{
+    entry->next = entries_.load(memory_order_relaxed);
+    while (!entries_.compare_exchange_weak(entry->next, entry, memory_order_release, memory_order_relaxed)) {
+    }
+}
+
+bool ResultPackWriter::append(const string &case_id, const string &payload, string &error_msg_)
+{
+    uint32_t id_len = uint32_t(case_id.size());
+    uint64_t payload_len = payload.size();
+    uint64_t checksum = record_checksum(case_id.data(), id_len, payload.data(), payload_len);
+
+    string record(kRecordHeader, '\0');
+    memcpy(&record[0], kRecordMagic, 4);
+    memcpy(&record[4], &id_len, 4);
+    memcpy(&record[8], &payload_len, 8);
+    memcpy(&record[16], &checksum, 8);
+    record += case_id;
+    record += payload;
+
+    // the only point where appenders meet
+    uint64_t offset = end_.fetch_add(record.size());
+    if (!pwrite_all(fd_, record.data(), record.size(), offset)) {
+        error_msg_ = "Could not write to the pack - '" + path_ + "': " + strerror(errno);
+        return false;
+    }
+    push(new Entry{case_id, id_hash(case_id.data(), case_id.size()), offset, record.size(), nullptr});
+    return true;
+}
+
+bool ResultPackWriter::close(string &error_msg_)
+{
+    if (fdatasync(fd_) != 0) {
+        error_msg_ = "Could not sync the pack - '" + path_ + "': " + strerror(errno);
+        return false;
+    }
+
+    // Step 1. records in file order, so a later record replaces an earlier one
+    vector<const Entry *> entries;
+    for (const Entry *e = entries_.load(memory_order_acquire); e; e = e->next) entries.push_back(e);
+    sort(entries.begin(), entries.end(), [](const Entry *a, const Entry *b) { return a->offset < b->offset; });
+
+    // Step 2. hash table at most half full. Probing compares ids, not just
+    // hashes, so two ids with the same hash keep a slot each.
+    uint64_t slots = 16;
+    while (slots < entries.size() * 2) slots <<= 1;
+    vector<const Entry *> slot_entries(slots, nullptr);
+    uint64_t count = 0;
+    for (const Entry *e : entries) {
+        uint64_t slot = e->id_hash & (slots - 1);
+        while (slot_entries[slot] && slot_entries[slot]->id != e->id) slot = (slot + 1) & (slots - 1);
+        if (!slot_entries[slot]) ++count;
+        slot_entries[slot] = e;
+    }
+    vector<uint64_t> table(slots * 3, 0);
+    for (uint64_t slot = 0; slot < slots; ++slot) {
+        const Entry *e = slot_entries[slot];
+        if (!e) continue;
+        table[slot * 3] = e->id_hash;
+        table[slot * 3 + 1] = e->offset;
+        table[slot * 3 + 2] = e->length;
+    }
+
+    // Step 3. replace PATH.idx atomically
+    string index(kIndexHeader, '\0');
+    memcpy(&index[0], kIndexMagic, 4);
+    memcpy(&index[4], &kIndexVersion, 4);
+    memcpy(&index[8], &slots, 8);
+    memcpy(&index[16], &count, 8);
+    index.append(reinterpret_cast<const char *>(table.data()), table.size() * 8);
+
+    string index_path = path_ + ".idx", tmp_path = index_path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && pwrite_all(fd, index.data(), index.size(), 0) && fdatasync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+    if (!ok || rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+        error_msg_ = "Could not write the pack index - '" + index_path + "': " + strerror(errno);
+        return false;
+    }
+
+    ::close(fd_);
+    fd_ = -1;
+    return true;
+}
+
+ResultPackReader::~ResultPackReader()
+{
+    if (pack_) munmap(const_cast<char *>(pack_), pack_size_);
+    if (index_) munmap(const_cast<char *>(index_), index_size_);
+}
+
+bool ResultPackReader::open(const string &path, string &error_msg_)
+{
+    if (!map_file(path, pack_, pack_size_, error_msg_) || !map_file(path + ".idx", index_, index_size_, error_msg_))
+        return false;
+
+    uint32_t version = 0;
+    uint64_t count = 0;
+    if (index_size_ >= kIndexHeader) {
+        memcpy(&version, index_ + 4, 4);
+        memcpy(&slots_, index_ + 8, 8);
+        memcpy(&count, index_ + 16, 8);
+    }
+    if (index_size_ < kIndexHeader || memcmp(index_, kIndexMagic, 4) != 0 || version != kIndexVersion ||
+        slots_ == 0 || (slots_ & (slots_ - 1)) != 0 || index_size_ != kIndexHeader + slots_ * kSlotSize) {
+        error_msg_ = "not a pack index - '" + path + ".idx'";
+        return false;
+    }
+    count_ = size_t(count);
+    return true;
+}
+
+bool ResultPackReader::find(const string &case_id, const char *&payload_, size_t &size_) const
+{
+    uint64_t h = id_hash(case_id.data(), case_id.size());
+    const char *slots = index_ + kIndexHeader;
+    for (uint64_t probe = 0, slot = h & (slots_ - 1); probe < slots_; ++probe, slot = (slot + 1) & (slots_ - 1)) {
+        uint64_t entry[3];
+        memcpy(entry, slots + slot * kSlotSize, kSlotSize);
+        if (entry[0] == 0) return false;
+        if (entry[0] != h) continue;
+
+        // the id in the record settles hash collisions
+        uint64_t offset = entry[1], length = entry[2];
+        if (offset > pack_size_ || length > pack_size_ - offset || length < kRecordHeader) return false;
+        const char *record = pack_ + offset;
+        uint32_t id_len;
+        memcpy(&id_len, record + 4, 4);
+        if (id_len != case_id.size() || kRecordHeader + id_len > length ||
+            memcmp(record + kRecordHeader, case_id.data(), id_len) != 0) continue;
+        payload_ = record + kRecordHeader + id_len;
+        size_ = size_t(length - kRecordHeader - id_len);
+        return true;
+    }
+    return false;
+}
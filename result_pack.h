@@ -0,0 +1,88 @@
+#ifndef DA_SEG_RESULT_PACK_H
+#define DA_SEG_RESULT_PACK_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Many cases' results in two files instead of a directory per case.
+//
+// PATH holds the records back to back, append-only:
+//   magic "QREC" | u32 id length | u64 payload length | u64 hash of id + payload | id | payload
+// PATH.idx is an open-addressing hash table of the records, written when the
+// writer closes and read through mmap, so finding a case reads one slot and
+// then the record itself:
+//   magic "QIDX" | u32 version | u64 slot count | u64 record count |
+//   slots of {u64 id hash, u64 offset, u64 record length}
+// A hash of 0 marks an empty slot. Ids that share a hash get slots of their
+// own; the id stored in the record tells them apart. When a case id is
+// appended twice the later record wins.
+
+// Appends records from any number of threads without a lock: each append
+// reserves its byte range with one atomic add and writes it with pwrite.
+// This is a thread-safe class.
+class ResultPackWriter {
+public:
+    explicit ResultPackWriter(const std::string &path);
+    ~ResultPackWriter();
+
+    ResultPackWriter(const ResultPackWriter &) = delete;
+    ResultPackWriter &operator=(const ResultPackWriter &) = delete;
+
+    // Opens or creates PATH. Intact records already in it are kept. Damaged
+    // ones, such as the holes left by appends in flight at a crash, are
+    // skipped and reported on stderr; damage after the last intact record is
+    // cut off. Must be called once before use.
+    bool open(std::string &error_msg_);
+
+    bool append(const std::string &case_id, const std::string &payload, std::string &error_msg_);
+
+    // fsyncs the records and writes PATH.idx covering all of them.
+    bool close(std::string &error_msg_);
+
+private:
+    struct Entry {
+        std::string id;
+        uint64_t id_hash;
+        uint64_t offset;
+        uint64_t length;
+        Entry *next;
+    };
+
+    void push(Entry *entry);
+
+    std::string path_;
+    int fd_ = -1;
+    std::atomic<uint64_t> end_{0};
+    // lock-free stack of appended records, turned into the index by close()
+    std::atomic<Entry *> entries_{nullptr};
+};
+
+// Read-only view of a closed pack. Both files are mapped, payloads are
+// returned without a copy. This is a thread-safe class once open.
+class ResultPackReader {
+public:
+    ResultPackReader() = default;
+    ~ResultPackReader();
+
+    ResultPackReader(const ResultPackReader &) = delete;
+    ResultPackReader &operator=(const ResultPackReader &) = delete;
+
+    bool open(const std::string &path, std::string &error_msg_);
+
+    // Payload of case_id, valid until the reader is destroyed
+    bool find(const std::string &case_id, const char *&payload_, size_t &size_) const;
+
+    size_t size() const { return count_; }
+
+private:
+    const char *pack_ = nullptr;
+    size_t pack_size_ = 0;
+    const char *index_ = nullptr;
+    size_t index_size_ = 0;
+    uint64_t slots_ = 0;
+    size_t count_ = 0;
+};
+
+#endif // DA_SEG_RESULT_PACK_H
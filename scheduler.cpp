@@ -0,0 +1,198 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// a task that does not fit the memory budget lets this many later tasks start first
+const size_t kMaxPassedOver = 32;
+
+} // namespace
+
+const char *priority_name(Priority priority)
+{
+  return priority == Priority::Interactive ? "interactive" : "bulk";
+}
+
+bool parse_priority(const string &name, Priority &priority)
+{
+  if (name == "interactive") priority = Priority::Interactive;
+  else if (name == "bulk") priority = Priority::Bulk;
+  else return false;
+  return true;
+}
+
+JobScheduler::JobScheduler(size_t workers, const vector<size_t> &reserved, size_t memory_budget)
+    : workers_(max<size_t>(workers, 1)), reserved_(reserved), memory_budget_(memory_budget)
+{
+    reserved_.resize(PRIORITY_COUNT, 0);
+
+    // reservations leave at least one shared worker, so no class can starve
+    size_t total = 0;
+    for (auto &r : reserved_) {
+        r = min(r, workers_ - 1 - total);
+        total += r;
+    }
+
+    for (size_t i = 0; i < workers_; ++i)
+        threads_.emplace_back(&JobScheduler::worker_loop, this);
+}
+
+JobScheduler::~JobScheduler()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &t : threads_) t.join();
+}
+
+uint64_t JobScheduler::submit(Priority priority, Task task, size_t memory)
+{
+    size_t cls = static_cast<size_t>(priority);
+    uint64_t ticket;
+    {
+        lock_guard<mutex> lock(mutex_);
+        ticket = next_ticket_++;
+        queues_[cls].push_back({ticket, move(task), chrono::steady_clock::now(), memory, 0});
+        ++submitted_[cls];
+    }
+    work_cv_.notify_all();
+    return ticket;
+}
+
+bool JobScheduler::cancel(uint64_t ticket)
+{
+    lock_guard<mutex> lock(mutex_);
+    for (size_t cls = 0; cls < PRIORITY_COUNT; ++cls) {
+        auto &q = queues_[cls];
+        auto it = find_if(q.begin(), q.end(), [&](const Item &item) { return item.ticket == ticket; });
+        if (it != q.end()) {
+            q.erase(it);
+            ++cancelled_[cls];
+            idle_cv_.notify_all();
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobScheduler::wait_idle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_cv_.wait(lock, [&] {
+        if (running_total_ > 0) return false;
+        for (auto &q : queues_) if (!q.empty()) return false;
+        return true;
+    });
+}
+
+bool JobScheduler::can_start(size_t cls) const
+{
+    if (running_total_ >= workers_) return false;
+
+    // idle workers that must stay free for other classes' reservations
+    size_t held = 0;
+    for (size_t other = 0; other < PRIORITY_COUNT; ++other)
+        if (other != cls && running_[other] < reserved_[other])
+            held += reserved_[other] - running_[other];
+
+    return workers_ - running_total_ > held;
+}
+
+bool JobScheduler::fits(const Item &item) const
+{
+    return memory_budget_ == 0 || memory_in_use_ == 0 || memory_in_use_ + item.memory <= memory_budget_;
+}
+
+size_t JobScheduler::pick(size_t cls) const
+{
+    const auto &q = queues_[cls];
+    for (size_t i = 0; i < q.size(); ++i) {
+        if (fits(q[i])) return i;
+        // waited long enough: nothing behind it may start first any more
+        if (q[i].passed_over >= kMaxPassedOver) break;
+    }
+    return q.size();
+}
+
+void JobScheduler::worker_loop()
+{
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+        size_t cls = PRIORITY_COUNT, at = 0;
+        work_cv_.wait(lock, [&] {
+            for (cls = 0; cls < PRIORITY_COUNT; ++cls)
+                if (!queues_[cls].empty() && can_start(cls) && (at = pick(cls)) < queues_[cls].size()) return true;
+            bool empty = true;
+            for (auto &q : queues_) empty = empty && q.empty();
+            return stop_ && empty;
+        });
+        if (cls == PRIORITY_COUNT) return;
+
+        auto &q = queues_[cls];
+        for (size_t i = 0; i < at; ++i)
+            if (q[i].passed_over++ == 0) ++held_back_;
+        Item item = move(q[at]);
+        q.erase(q.begin() + at);
+        waits_[cls].push_back(chrono::duration<double>(chrono::steady_clock::now() - item.submitted).count());
+        ++running_[cls];
+        ++running_total_;
+        memory_in_use_ += item.memory;
+        peak_memory_ = max(peak_memory_, memory_in_use_);
+
+        lock.unlock();
+        item.task();
+        lock.lock();
+
+        --running_[cls];
+        --running_total_;
+        memory_in_use_ -= item.memory;
+        // a finished task can unblock any class, not only its own
+        work_cv_.notify_all();
+        idle_cv_.notify_all();
+    }
+}
+
+QueueStats JobScheduler::stats(Priority priority) const
+{
+    size_t cls = static_cast<size_t>(priority);
+    lock_guard<mutex> lock(mutex_);
+
+    QueueStats s;
+    s.submitted = submitted_[cls];
+    s.started = waits_[cls].size();
+    s.cancelled = cancelled_[cls];
+    s.running = running_[cls];
+    s.queued = queues_[cls].size();
+
+    if (!waits_[cls].empty()) {
+        vector<double> waits = waits_[cls];
+        sort(waits.begin(), waits.end());
+        double sum = 0;
+        for (double w : waits) sum += w;
+        s.mean_wait = sum / waits.size();
+        s.p95_wait = waits[min(waits.size() - 1, waits.size() * 95 / 100)];
+        s.max_wait = waits.back();
+    }
+    return s;
+}
+
+void JobScheduler::print_stats(ostream &os) const
+{
+    for (size_t cls = 0; cls < PRIORITY_COUNT; ++cls) {
+        Priority priority = static_cast<Priority>(cls);
+        QueueStats s = stats(priority);
+        os << priority_name(priority) << ": " << s.started << "/" << s.submitted << " started, "
+           << s.cancelled << " cancelled, queue wait mean " << s.mean_wait << "s p95 " << s.p95_wait
+           << "s max " << s.max_wait << "s" << endl;
+    }
+    if (memory_budget_ > 0) {
+        lock_guard<mutex> lock(mutex_);
+        os << "memory: peak " << (peak_memory_ >> 20) << " MB of " << (memory_budget_ >> 20) << " MB budget admitted, "
+           << held_back_ << " jobs held back" << endl;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef DA_SEG_SCHEDULER_H
+#define DA_SEG_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Lower value runs first
+enum class Priority {
+    Interactive = 0,
+    Bulk = 1,
+};
+
+const size_t PRIORITY_COUNT = 2;
+
+const char *priority_name(Priority priority);
+bool parse_priority(const std::string &name, Priority &priority);
+
+struct QueueStats {
+    size_t submitted = 0;
+    size_t started = 0;
+    size_t cancelled = 0;
+    size_t running = 0;
+    size_t queued = 0;
+    double mean_wait = 0;   // seconds from submit() to start
+    double p95_wait = 0;
+    double max_wait = 0;
+};
+
+// Fixed pool of workers running segment_jaw-style blocking tasks.
+//
+// A free worker always takes the oldest task of the highest priority class that
+// may start, so queued (not yet started) bulk work is overtaken by interactive
+// work submitted later. reserved[c] workers are kept for class c: other classes
+// only start while enough idle workers remain to cover every unmet reservation.
+//
+// With a memory budget, each task declares its estimated memory and only starts
+// while the estimates of running tasks plus its own stay within the budget.
+// A task that does not fit is passed over by later, smaller tasks of its class,
+// but only a limited number of times; after that its class waits until it fits.
+// A task larger than the whole budget starts once nothing else is running.
+// This is a thread-safe class.
+class JobScheduler {
+public:
+    using Task = std::function<void()>;
+
+    // memory_budget in bytes, 0 for none
+    JobScheduler(size_t workers, const std::vector<size_t> &reserved = {}, size_t memory_budget = 0);
+    // Runs everything still queued, then joins the workers.
+    ~JobScheduler();
+
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler &operator=(const JobScheduler &) = delete;
+
+    // Returns a ticket usable with cancel(). memory is the task's estimated
+    // peak in bytes, only used with a memory budget.
+    uint64_t submit(Priority priority, Task task, size_t memory = 0);
+
+    // Drops a task that has not started yet. Returns false if it already started.
+    bool cancel(uint64_t ticket);
+
+    // Blocks until no task is queued or running
+    void wait_idle();
+
+    QueueStats stats(Priority priority) const;
+    void print_stats(std::ostream &os) const;
+
+private:
+    struct Item {
+        uint64_t ticket;
+        Task task;
+        std::chrono::steady_clock::time_point submitted;
+        size_t memory;
+        size_t passed_over;   // times a later task of the class started first
+    };
+
+    void worker_loop();
+    bool can_start(size_t cls) const;
+    // Position of the task of class cls to start next, or the queue size if none fits
+    size_t pick(size_t cls) const;
+    bool fits(const Item &item) const;
+
+    size_t workers_;
+    std::vector<size_t> reserved_;
+    size_t memory_budget_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<Item> queues_[PRIORITY_COUNT];
+    size_t running_[PRIORITY_COUNT] = {};
+    size_t running_total_ = 0;
+    uint64_t next_ticket_ = 1;
+    bool stop_ = false;
+    size_t memory_in_use_ = 0;
+    size_t peak_memory_ = 0;
+    size_t held_back_ = 0;   // tasks passed over at least once for lack of memory
+
+    size_t submitted_[PRIORITY_COUNT] = {};
+    size_t cancelled_[PRIORITY_COUNT] = {};
+    std::vector<double> waits_[PRIORITY_COUNT];
+
+    std::vector<std::thread> threads_;
+};
+
+#endif // DA_SEG_SCHEDULER_H
@@ -3,11 +3,19 @@
 #include <fstream>
 #include <sstream>
 #include <cstdio>
+#include <cctype>
 #include <string>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <utility>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
 
 #include <cpr/cpr.h>
 #include "rapidjson/document.h"
@@ -15,6 +23,26 @@
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 
+#include "decimate.h"
+#include "hash.h"
+#include "http_engine.h"
+#include "journal.h"
+#include "label_boundary.h"
+#include "label_cleanup.h"
+#include "label_transfer.h"
+#include "memory_stats.h"
+#include "mesh.h"
+#include "mesh_archive.h"
+#include "mesh_check.h"
+#include "output_writer.h"
+#include "ply.h"
+#include "result_pack.h"
+#include "scheduler.h"
+#include "session_pool.h"
+#include "single_flight.h"
+#include "tooth_split.h"
+#include "tooth_stats.h"
+
 using namespace rapidjson;
 using namespace std;
 namespace fs = std::filesystem;
@@ -55,58 +83,90 @@ inline double to_sec( T t )
 }
 
 
-// This is a thread-safe function. You can start multiple threads and execute this function
-bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vector<int> &label_,
-                string &error_msg_){
-    /* This is the function to segment a jaw using ChohoTech Cloud Service.
+struct JobSpec {
+    string group;
+    string name;
+    string version;
 
-        Input:
-            stl_file_path: path to the stl file
-            jaw_type: must be either "L" or "U", standing for Lower Jaw and Upper Jaw
-        Output:
-            stl_: string containing preprocessed mesh data in STL format. This can directly be saved as *.stl file
-            label_: segmentation labels corresponding to the output stl_
-            error_msg_: error message if job failed
-        Returns:
-            boolean: true - job successful and results saved to stl_ and label_. false - check error_msg_ for error message
+    string str() const { return group + "/" + name + "/" + version; }
+};
 
-       NOTE: if return value is false, stl_, label_is meaningless, DO NOT USE!!!
-    */
+const JobSpec SEG_SPEC = {"mesh-processing", "oral-seg", "1.0-snapshot"};
 
-    // Step 1. make input
-    ifstream infile(stl_file_path, ifstream::binary);
-    if (!infile.is_open()) {
-        cerr << "Could not open the file - '"
-             << stl_file_path << "'" << endl;
-        exit(EXIT_FAILURE);
+// Every request goes through here, so connections to the service and the file
+// server stay open from one request to the next
+SessionPool http_sessions;
+
+// optional. The small control requests (upload url, submit, status, result)
+// go through this engine instead, multiplexed over a few HTTP/2 connections
+HttpEngine *control_engine = nullptr;
+
+cpr::Response control_get(const string &url, const cpr::Header &header){
+    if (!control_engine) return http_sessions.get(url, header);
+    HttpRequest request;
+    request.url = url;
+    request.header = header;
+    return control_engine->perform(move(request));
+}
+
+cpr::Response control_post(const string &url, const string &body, const cpr::Header &header){
+    if (!control_engine) return http_sessions.post(url, body, header);
+    HttpRequest request;
+    request.method = "POST";
+    request.url = url;
+    request.header = header;
+    request.body = body;
+    return control_engine->perform(move(request));
+}
+
+// Body of GET upload_url: the presigned url as a JSON string
+bool unquote_upload_url(const string &text, string &upload_url_, string &error_msg_){
+    if (text.size() < 2 || text.front() != '"' || text.back() != '"') {
+        error_msg_ = "upload url response is not a quoted string: " + text.substr(0, 200);
+        return false;
     }
+    upload_url_ = text.substr(1, text.size() - 2);
+    return true;
+}
 
-    string buffer((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
-    infile.close();
+// The urn of a file uploaded to a presigned upload url
+bool urn_from_upload_url(const string &upload_url, string &urn, string &error_msg_){
+    string user_id = string(USER_ID);
+    auto l_pos = upload_url.find(user_id);
+    if(l_pos == upload_url.npos) {
+        error_msg_ = "url format is wrong: " + upload_url;
+        return false;
+    }
+    l_pos += user_id.size() + 1;
+    auto r_pos = upload_url.find("?");
+    size_t url_cut_len = r_pos - l_pos;
+    if(r_pos <= l_pos){
+        error_msg_ = "url format is wrong: " + upload_url;
+        return false;
+    } else if (r_pos == upload_url.npos) url_cut_len = upload_url.size() - l_pos;
+    urn = "urn:zhfile:o:s:APIClient:"+user_id+":"+upload_url.substr(l_pos, url_cut_len);
+    return true;
+}
+
+// Step 1.1 upload to file server
+bool upload_mesh(const string &buffer, string &urn, string &error_msg_, const string &mesh_type = "stl"){
     string user_id = string(USER_ID);
     string zh_token = string(USER_TOKEN);
 
     auto start = now();
 
-    // Step 1.1 upload to file server
-    cpr::Response r = cpr::Get(cpr::Url{string(FILE_SERVER_URL) + "/scratch/APIClient/" + user_id + "/upload_url?postfix=stl"},
-                               cpr::Header{{"X-ZH-TOKEN", zh_token}},
-                               cpr::VerifySsl(0)
-    );
+    cpr::Response r = control_get(string(FILE_SERVER_URL) + "/scratch/APIClient/" + user_id + "/upload_url?postfix=" + mesh_type,
+                                  cpr::Header{{"X-ZH-TOKEN", zh_token}});
 
     if (r.status_code > 300) {
         error_msg_ = "get upload_url request failed with error code: " + to_string(r.status_code);
         return false;
     }
 
-    string upload_url = string(r.text.c_str());
-    upload_url = upload_url.substr(1, upload_url.size()-2);
+    string upload_url;
+    if (!unquote_upload_url(r.text, upload_url, error_msg_)) return false;
 
-    r = cpr::Put(cpr::Url{upload_url},
-        cpr::Body{buffer},
-        cpr::Header{{"content-type", ""}},
-        cpr::VerifySsl(0)
-    );
+    r = http_sessions.put(upload_url, buffer, cpr::Header{{"content-type", ""}});
 
     if (r.status_code > 300) {
         error_msg_ = "file upload request failed with error code: " + to_string(r.status_code);
@@ -115,36 +175,17 @@ bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vecto
 
     cout << "uploading mesh takes " << to_sec(now() - start) << " seconds" << endl;
 
-    auto l_pos = upload_url.find(user_id);
-    if(l_pos == upload_url.npos) {
-        error_msg_ = "url format is wrong: " + upload_url;
-        return false;
-    }
-    l_pos += user_id.size() + 1;
-    auto r_pos = upload_url.find("?");
-    size_t url_cut_len = r_pos - l_pos;
-    if(r_pos <= l_pos){
-        error_msg_ = "url format is wrong: " + upload_url;
-        return false;
-    } else if (r_pos == upload_url.npos) url_cut_len = upload_url.size() - l_pos;
-    string urn = "urn:zhfile:o:s:APIClient:"+user_id+":"+upload_url.substr(l_pos, url_cut_len);
+    if (!urn_from_upload_url(upload_url, urn, error_msg_)) return false;
 
     cout << "Uploaded to urn: " << urn << endl;
+    return true;
+}
 
-    Document input_data(kObjectType);
-    Document input_data_mesh_config(kObjectType);
-    add_string_member(input_data_mesh_config, "type", "stl");
-    add_string_member(input_data_mesh_config, "data", urn);
-    input_data.AddMember(
-        "mesh",
-        input_data_mesh_config,
-        input_data.GetAllocator());
-
-    add_string_member(input_data, "jaw_type", (jaw_type=='L')?"Lower":"Upper");
-
+// Body of POST /run. input_data is moved into it.
+string job_request_body(const JobSpec &spec, Document &input_data, const string &output_mesh_type){
     Document output_config(kObjectType);
     Document output_config_mesh(kObjectType);
-    add_string_member(output_config_mesh, "type", "stl");
+    add_string_member(output_config_mesh, "type", output_mesh_type);
     output_config.AddMember(
         "mesh",
         output_config_mesh,
@@ -153,9 +194,9 @@ bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vecto
     Document request_body(kObjectType);
 
     auto& request_body_allocator = request_body.GetAllocator();
-    add_string_member(request_body, "spec_group", "mesh-processing");
-    add_string_member(request_body, "spec_name", "oral-seg");
-    add_string_member(request_body, "spec_version", "1.0-snapshot");
+    add_string_member(request_body, "spec_group", spec.group);
+    add_string_member(request_body, "spec_name", spec.name);
+    add_string_member(request_body, "spec_version", spec.version);
     add_string_member(request_body, "user_group", "APIClient");
     add_string_member(request_body, "user_id", USER_ID);
     request_body.AddMember(
@@ -167,56 +208,114 @@ bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vecto
         "output_config",
         output_config,
         request_body_allocator);
+    return dump_json(request_body);
+}
 
-    // Step 2. submit job
-    r = cpr::Post(cpr::Url{string(SERVER_URL) + "/run"},
-                  cpr::Body{dump_json(request_body)},
-                  cpr::Header{{"Content-Type", "application/json"}, {"X-ZH-TOKEN", string(USER_TOKEN)}},
-                  cpr::VerifySsl(0) // do not add this line in production for safty reason
-                 );
+// Body of POST /run
+bool parse_run_id(const string &text, string &job_id_, string &error_msg_){
+    Document document;
+    document.Parse(text.c_str());
+    if (document.HasParseError() || !document.IsObject() || !document.HasMember("run_id") ||
+        !document["run_id"].IsString()) {
+        error_msg_ = "job creation response has no run_id";
+        return false;
+    }
+    job_id_ = document["run_id"].GetString();
+    return true;
+}
+
+// Step 2. submit job
+// input_data is moved into the request body
+bool submit_job(const JobSpec &spec, Document &input_data, const string &output_mesh_type,
+                string &job_id, string &error_msg_){
+    cpr::Response r = control_post(string(SERVER_URL) + "/run", job_request_body(spec, input_data, output_mesh_type),
+                  cpr::Header{{"Content-Type", "application/json"}, {"X-ZH-TOKEN", string(USER_TOKEN)}});
 
     if (r.status_code > 300) {
         error_msg_ = "job creation request failed with error code: " + to_string(r.status_code);
         return false;
     }
 
-    Document document;
-    document.Parse(r.text.c_str());
-    string job_id = document["run_id"].GetString();
+    if (!parse_run_id(r.text, job_id, error_msg_)) return false;
 
     cout << "run id is: " << job_id << endl;
+    return true;
+}
+
+// Adds the "mesh" input of a job. data is an urn, either uploaded or output by an earlier job
+void add_mesh_input(Document &input_data, const string &type, const string &urn){
+    Document input_data_mesh_config(kObjectType);
+    add_string_member(input_data_mesh_config, "type", type);
+    add_string_member(input_data_mesh_config, "data", urn);
+    input_data.AddMember(
+        "mesh",
+        input_data_mesh_config,
+        input_data.GetAllocator());
+}
+
+void add_seg_input(Document &input_data, const string &urn, char jaw_type, const string &mesh_type){
+    add_mesh_input(input_data, mesh_type, urn);
+    add_string_member(input_data, "jaw_type", (jaw_type=='L')?"Lower":"Upper");
+}
 
-    start = now();
+// mesh_type: "stl" or "ply", of the uploaded mesh and of the result mesh
+bool submit_seg_job(const string &urn, char jaw_type, string &job_id, string &error_msg_,
+                    const string &mesh_type = "stl"){
+    Document input_data(kObjectType);
+    add_seg_input(input_data, urn, jaw_type, mesh_type);
+    return submit_job(SEG_SPEC, input_data, mesh_type, job_id, error_msg_);
+}
+
+// Body of GET /run/{id}. Fails, with job_failed_ set, if the job failed on the server.
+bool parse_job_status(const string &text, bool &completed_, bool &job_failed_, string &error_msg_){
+    Document document_stat;
+    document_stat.Parse(text.c_str());
+    if (document_stat.HasParseError() || !document_stat.IsObject() ||
+        !document_stat.HasMember("failed") || !document_stat["failed"].IsBool() ||
+        !document_stat.HasMember("completed") || !document_stat["completed"].IsBool()) {
+        error_msg_ = "job status response is malformed";
+        return false;
+    }
+
+    job_failed_ = document_stat["failed"].GetBool();
+    if (job_failed_) {
+        const char *reason = (document_stat.HasMember("reason_public") && document_stat["reason_public"].IsString())
+                             ? document_stat["reason_public"].GetString() : "unknown";
+        error_msg_ = string("job failed with error: ") + reason;
+        return false;
+    }
+    completed_ = document_stat["completed"].GetBool();
+    return true;
+}
+
+// Step 3. check job
+// job_failed_ tells a job that failed on the server apart from a failed status request
+bool wait_job(const string &job_id, bool &job_failed_, string &error_msg_){
+    auto start = now();
 
-    // Step 3. check job
     bool status = false;
+    job_failed_ = false;
 
     while(!status){
         this_thread::sleep_for(chrono::milliseconds(3000)); // sleep 3s
-        cpr::Response r_stat = cpr::Get(cpr::Url{string(SERVER_URL) + "/run/" + job_id},
-                                        cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, cpr::VerifySsl(0));
+        cpr::Response r_stat = control_get(string(SERVER_URL) + "/run/" + job_id,
+                                           cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}});
         if (r_stat.status_code > 300) {
             error_msg_ = "job status request failed with error code: " + to_string(r_stat.status_code);
             return false;
         }
 
-        Document document_stat;
-        document_stat.Parse(r_stat.text.c_str());
-
-        status = document_stat["failed"].GetBool();
-        if(status){
-            error_msg_ = string("job failed with error: ") + document_stat["reason_public"].GetString();
-            return false;
-        }
-
-        status = document_stat["completed"].GetBool();
+        if (!parse_job_status(r_stat.text, status, job_failed_, error_msg_)) return false;
     }
 
     cout << "job run takes " << to_sec(now() - start) << " seconds" << endl;
+    return true;
+}
 
-    // Step 4. get job result
-    r = cpr::Get(cpr::Url{string(SERVER_URL) + "/data/" + job_id},
-                 cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, cpr::VerifySsl(0));
+// Step 4. get job result
+bool get_result(const string &job_id, Document &document_result, string &error_msg_){
+    cpr::Response r = control_get(string(SERVER_URL) + "/data/" + job_id,
+                                  cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}});
 
 
     if (r.status_code > 300) {
@@ -224,64 +323,1466 @@ bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vecto
         return false;
     }
 
-    // Step 5. parse result
+    document_result.Parse(r.text.c_str());
+    return true;
+}
+
+// Step 5.1 download mesh
+bool download_mesh(const string &download_urn, string &mesh_, string &error_msg_){
+    cpr::Response r = http_sessions.get(string(FILE_SERVER_URL) + "/file/download?urn=" + download_urn,
+                                        cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}});
+
+    if (r.status_code > 300) {
+        error_msg_ = "mesh download request failed with error code: " + to_string(r.status_code);
+        return false;
+    }
+
+    mesh_ = move(r.text);
+    return true;
+}
 
+// A result mesh on the file server, downloaded on first access.
+// This is a thread-safe class: concurrent first accesses share one download,
+// and a failed download is retried by the next access.
+class LazyMesh {
+public:
+    explicit LazyMesh(const string &urn) : urn_(urn) {}
+    // already downloaded
+    LazyMesh(const string &urn, string &&data) : urn_(urn), loaded_(true), data_(move(data)) {}
+
+    // can be passed to run_job_chain without downloading anything
+    const string &urn() const { return urn_; }
+
+    bool loaded() const {
+        lock_guard<mutex> lock(mutex_);
+        return loaded_;
+    }
+
+    // On success mesh_ points to the mesh data, owned by this object
+    bool get(const string *&mesh_, string &error_msg_) const {
+        lock_guard<mutex> lock(mutex_);
+        if (!loaded_) {
+            if (!download_mesh(urn_, data_, error_msg_)) return false;
+            loaded_ = true;
+        }
+        mesh_ = &data_;
+        return true;
+    }
+
+private:
+    string urn_;
+    mutable mutex mutex_;
+    mutable bool loaded_ = false;
+    mutable string data_;
+};
+
+struct SegResult {
+    vector<int> label;
+    shared_ptr<LazyMesh> mesh; // preprocessed mesh, in SegOptions::mesh_type format
+};
+
+enum class MeshCheck { Off, Reject, Repair };
+
+struct SegOptions {
+    // optional. Every job transition is recorded there, and a job already
+    // uploaded / submitted for the same file is resumed instead of resubmitted
+    JobJournal *journal = nullptr;
+    // true: the mesh is only downloaded when result_->mesh->get() is first called.
+    // Saves the largest transfer for callers that only need labels or the urn.
+    bool lazy_mesh = false;
+    // > 0: meshes with more triangles are decimated to about this many before
+    // upload. Labels then refer to the decimated mesh; map them back with
+    // OutputOptions::original_labels.
+    size_t decimate_triangles = 0;
+    // integrity check of the input before upload. Reject fails the job on
+    // degenerate or duplicate faces and non-manifold edges; Repair drops the
+    // bad faces first and only fails on non-manifold edges left after that.
+    MeshCheck check = MeshCheck::Off;
+    // "stl" or "ply": format of the uploaded mesh and of the result mesh.
+    // Input files of the other format are converted before upload.
+    string mesh_type = "stl";
+    // print the heap use of each segment_jaw call (allocations, peak live
+    // bytes, see memory_stats.h) and the process RSS when it returns
+    bool memory_stats = false;
+};
+
+// Step 5. parse result: the labels, and the urn of the result mesh
+bool read_result(Document &document_result, SegResult &result_, string &mesh_urn_, string &error_msg_){
+    if (document_result.HasParseError() || !document_result.IsObject() ||
+        !document_result.HasMember("seg_labels") || !document_result["seg_labels"].IsArray() ||
+        !document_result.HasMember("mesh") || !document_result["mesh"].IsObject() ||
+        !document_result["mesh"].HasMember("data") || !document_result["mesh"]["data"].IsString()) {
+        error_msg_ = "job result is malformed";
+        return false;
+    }
+    result_.label.clear();
+    for (auto& v : document_result["seg_labels"].GetArray()) {
+        if (!v.IsNumber()) {
+            error_msg_ = "job result has a non-numeric label";
+            return false;
+        }
+        result_.label.push_back(v.IsInt()?v.GetInt(): (int)(v.GetDouble() + 0.1));
+    }
+    mesh_urn_ = document_result["mesh"]["data"].GetString();
+    return true;
+}
+
+// Step 4. get job result and Step 5. parse result
+bool fetch_result(const string &job_id, bool lazy_mesh, SegResult &result_, string &error_msg_){
     Document document_result;
-    document_result.Parse(r.text.c_str());
+    if (!get_result(job_id, document_result, error_msg_)) return false;
+
+    string mesh_urn;
+    if (!read_result(document_result, result_, mesh_urn, error_msg_)) return false;
+    result_.mesh = make_shared<LazyMesh>(mesh_urn);
+    const string *mesh;
+    if (!lazy_mesh && !result_.mesh->get(mesh, error_msg_)) return false;
+    return true;
+}
+
+// One job of a chain. Its "mesh" input is the output mesh of the step before.
+struct JobStep {
+    JobSpec spec;
+    string input_data_json = "{}"; // other input_data members, e.g. {"jaw_type": "Lower"}
+    string output_mesh_type = "stl";
+};
+
+struct StepResult {
+    string run_id;
+    string result_json;  // body of /data/{run_id}
+    string mesh_urn;     // output mesh, stays on the file server
+};
+
+// This is a thread-safe function. You can start multiple threads and execute this function
+bool run_job_chain(const string &input_urn, const string &input_mesh_type, const vector<JobStep> &steps,
+                   vector<StepResult> &results_, string &error_msg_){
+    /* Runs steps one after another, passing each output mesh urn on as the next input.
+       Intermediate meshes never leave the server: nothing is downloaded or uploaded
+       between steps. Use download_mesh on the last mesh_urn if the mesh is needed locally.
+
+        Input:
+            input_urn: urn of the first input mesh, from upload_mesh or an earlier job
+            input_mesh_type: type of that mesh, e.g. "stl"
+        Output:
+            results_: one entry per finished step
+            error_msg_: error message of the first failed step
+    */
+    results_.clear();
+    string urn = input_urn;
+    string mesh_type = input_mesh_type;
 
-    // Step 5.1 download mesh
-    string download_urn = document_result["mesh"]["data"].GetString();
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const JobStep &step = steps[i];
+        // every error names the step it comes from
+        auto fail = [&](const string &error_msg) {
+            error_msg_ = "step " + to_string(i) + " (" + step.spec.str() + "): " + error_msg;
+            return false;
+        };
 
-    r = cpr::Get(cpr::Url{string(FILE_SERVER_URL) + "/file/download?urn=" + download_urn},
-                 cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, cpr::VerifySsl(0));
+        Document input_data;
+        input_data.Parse(step.input_data_json.c_str());
+        if (input_data.HasParseError() || !input_data.IsObject()) return fail("input_data_json is not a JSON object");
+        input_data.RemoveMember("mesh");
+        add_mesh_input(input_data, mesh_type, urn);
 
-    stl_ = string(r.text);
+        StepResult result;
+        bool job_failed = false;
+        string error_msg;
+        Document document_result;
+        if (!submit_job(step.spec, input_data, step.output_mesh_type, result.run_id, error_msg) ||
+            !wait_job(result.run_id, job_failed, error_msg) ||
+            !get_result(result.run_id, document_result, error_msg)) return fail(error_msg);
+        if (!document_result.IsObject()) return fail("job result is not a JSON object");
+        if (document_result.HasMember("mesh") && document_result["mesh"].IsObject() &&
+            document_result["mesh"].HasMember("data") && document_result["mesh"]["data"].IsString())
+            result.mesh_urn = document_result["mesh"]["data"].GetString();
+        result.result_json = dump_json(document_result);
+        results_.push_back(result);
 
-    label_.clear();
-    for (auto& v : document_result["seg_labels"].GetArray()) label_.push_back(v.IsInt()?v.GetInt(): (int)(v.GetDouble() + 0.1));
+        if (i + 1 < steps.size() && result.mesh_urn.empty()) return fail("no output mesh to pass on");
+        urn = result.mesh_urn;
+        mesh_type = step.output_mesh_type;
+    }
+    return true;
+}
 
+// GROUP/NAME/VERSION[,INPUT_JSON], e.g. mesh-processing/oral-seg/1.0-snapshot,{"jaw_type":"Lower"}
+bool parse_job_step(const string &text, JobStep &step_, string &error_msg_){
+    size_t comma = text.find(',');
+    string spec = text.substr(0, comma);
+    size_t first = spec.find('/'), last = spec.rfind('/');
+    if (first == string::npos || first == last || first == 0 || last + 1 == spec.size()) {
+        error_msg_ = "job spec must be GROUP/NAME/VERSION: " + spec;
+        return false;
+    }
+    step_.spec = {spec.substr(0, first), spec.substr(first + 1, last - first - 1), spec.substr(last + 1)};
+    if (comma != string::npos) step_.input_data_json = text.substr(comma + 1);
     return true;
 }
 
-int main(int argc,char *argv[]){
-    if(argc < 3) {
-        cout << "Usage: ./seg PATH_TO_STL PATH_TO_RESULT_DIR" << endl;
-        return 1;
+// Step 1.0 check, repair, shrink and convert the mesh before upload, as options ask.
+// Leaves prepared_ empty when the mesh is uploaded as it is.
+bool prepare_upload(const string &buffer, const SegOptions &options, string &prepared_, string &error_msg_){
+    bool convert = is_ply(buffer) != (options.mesh_type == "ply");
+    if (options.check == MeshCheck::Off && options.decimate_triangles == 0 && !convert) return true;
+
+    IndexedMesh mesh;
+    if (!read_mesh(buffer, mesh, error_msg_)) return false;
+    bool changed = convert;
+
+    if (options.check != MeshCheck::Off) {
+        auto start = now();
+        MeshCheckReport report;
+        check_mesh(mesh, report);
+        cout << "mesh check: " << report.str() << ", takes " << to_sec(now() - start) << " seconds" << endl;
+        if (report.has_defects() && options.check == MeshCheck::Repair) {
+            size_t dropped = repair_mesh(mesh);
+            changed = dropped > 0;
+            check_mesh(mesh, report);
+            cout << "mesh repair dropped " << dropped << " faces" << endl;
+        }
+        if (report.has_defects()) {
+            error_msg_ = "input mesh rejected: " + report.str();
+            return false;
+        }
+    }
+
+    if (options.decimate_triangles > 0 && mesh.triangle_count() > options.decimate_triangles) {
+        auto start = now();
+        IndexedMesh reduced;
+        DecimateStats stats;
+        decimate(mesh, options.decimate_triangles, reduced, &stats);
+        mesh = move(reduced);
+        changed = true;
+        cout << "decimated " << stats.input_triangles << " -> " << stats.output_triangles << " triangles in "
+             << stats.passes << " passes, takes " << to_sec(now() - start) << " seconds" << endl;
+    }
+
+    if (!changed) return true;
+    if (options.mesh_type == "ply") write_ply(mesh, prepared_);
+    else write_stl(mesh, prepared_);
+    return true;
+}
+
+// Steps 1.1 - 5 for a mesh already in memory. With a journal, steps done by an
+// earlier process for the same input are skipped.
+bool run_job(const string &buffer, uint64_t input_hash, char jaw_type, SegResult &result_,
+             string &error_msg_, const SegOptions &options){
+    JobJournal *journal = options.journal;
+    JournalEntry entry;
+    bool resumed = journal && journal->lookup(input_hash, jaw_type, entry);
+
+    string urn = resumed ? entry.urn : "";
+    string job_id = resumed ? entry.run_id : "";
+    bool completed = resumed && entry.state == "completed";
+
+    if (urn.empty()) {
+        string prepared;
+        if (!prepare_upload(buffer, options, prepared, error_msg_)) return false;
+        if (!upload_mesh(prepared.empty() ? buffer : prepared, urn, error_msg_, options.mesh_type)) return false;
+        if (journal) journal->record({input_hash, jaw_type, "uploaded", urn, ""});
+    }
+
+    if (job_id.empty()) {
+        if (!submit_seg_job(urn, jaw_type, job_id, error_msg_, options.mesh_type)) return false;
+        if (journal) journal->record({input_hash, jaw_type, "submitted", urn, job_id});
+    } else {
+        cout << "resuming run id: " << job_id << endl;
+    }
+
+    if (!completed) {
+        bool job_failed = false;
+        if (!wait_job(job_id, job_failed, error_msg_)) {
+            if (journal && job_failed) journal->record({input_hash, jaw_type, "failed", urn, job_id});
+            return false;
+        }
+        if (journal) journal->record({input_hash, jaw_type, "completed", urn, job_id});
+    }
+
+    if (!fetch_result(job_id, options.lazy_mesh, result_, error_msg_)) return false;
+    if (journal) journal->record({input_hash, jaw_type, "fetched", urn, job_id});
+
+    return true;
+}
+
+bool read_file(const string &path, string &data_, string &error_msg_){
+    ifstream infile(path, ifstream::binary);
+    if (!infile.is_open()) {
+        error_msg_ = "Could not open the file - '" + path + "'";
+        return false;
+    }
+    data_.assign((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Identical concurrent submissions (same content, jaw and spec) share one cloud job
+SingleFlight<SegResult> inflight_jobs;
+
+// Identifies the job input in the journal and among in-flight jobs
+uint64_t job_input_hash(const string &buffer, const SegOptions &options){
+    uint64_t input_hash = hash_bytes(buffer);
+    // a repaired, decimated or converted upload is a different job input than the file
+    if (options.decimate_triangles > 0) {
+        uint64_t target = options.decimate_triangles;
+        input_hash = hash_bytes((const char*)&target, sizeof(target), input_hash);
+    }
+    if (options.check == MeshCheck::Repair) input_hash = hash_bytes("repair", 6, input_hash);
+    if (options.mesh_type != "stl") input_hash = hash_bytes(options.mesh_type.data(), options.mesh_type.size(), input_hash);
+    return input_hash;
+}
+
+// Calls with the same key may share one job and its result, so the key holds
+// every option that changes the outcome: the upload (input_hash), the jaw,
+// the spec and the check mode, as a rejected input fails where an unchecked
+// one does not. lazy_mesh is settled per caller after the job.
+string job_flight_key(uint64_t input_hash, char jaw_type, const SegOptions &options){
+    return hash_to_hex(input_hash) + ":" + jaw_type + ":" + SEG_SPEC.str() + ":check" +
+           to_string(int(options.check));
+}
+
+// This is a thread-safe function. You can start multiple threads and execute this function
+bool segment_jaw(const string &stl_file_path, char jaw_type, shared_ptr<const SegResult> &result_,
+                string &error_msg_, const SegOptions &options = SegOptions()){
+    /* This is the function to segment a jaw using ChohoTech Cloud Service.
+
+        Input:
+            stl_file_path: path to the stl file
+            jaw_type: must be either "L" or "U", standing for Lower Jaw and Upper Jaw
+            options: journal and lazy mesh download, see SegOptions
+        Output:
+            result_: result_->mesh->get() gives the preprocessed mesh data in STL format. This can directly be saved as *.stl file
+                     result_->label are the segmentation labels corresponding to that mesh
+                     If the same file is being segmented by another thread, both calls wait for
+                     one cloud job and get the same result_ object.
+            error_msg_: error message if job failed
+        Returns:
+            boolean: true - job successful and results saved to result_. false - check error_msg_ for error message
+
+       NOTE: if return value is false, result_ is meaningless, DO NOT USE!!!
+    */
+
+    MemoryArena arena;
+    MemoryScope scope(options.memory_stats ? &arena : current_memory_arena());
+    auto report_memory = [&]() {
+        if (!options.memory_stats) return;
+        ProcessMemory process = process_memory();
+        cout << "memory of " << stl_file_path << ": " << arena.str() << ", process RSS " << (process.rss >> 20)
+             << " MB, peak " << (process.peak_rss >> 20) << " MB" << endl;
+    };
+
+    // Step 1. make input
+    string buffer;
+    if (!read_file(stl_file_path, buffer, error_msg_)) return false;
+
+    uint64_t input_hash = job_input_hash(buffer, options);
+    string key = job_flight_key(input_hash, jaw_type, options);
+
+    bool shared = false;
+    bool ok = inflight_jobs.run(key, [&](SegResult &result, string &error_msg) {
+        return run_job(buffer, input_hash, jaw_type, result, error_msg, options);
+    }, result_, error_msg_, &shared);
+    if (ok && shared) cout << "attached to in-flight job for the same input" << endl;
+
+    // the job may have been started by a caller that wanted a lazy mesh
+    const string *mesh;
+    if (ok && !options.lazy_mesh && !result_->mesh->get(mesh, error_msg_)) ok = false;
+    report_memory();
+    return ok;
+}
+
+// This is a thread-safe function. You can start multiple threads and execute this function
+bool segment_jaw(const string &stl_file_path, char jaw_type, string &stl_, vector<int> &label_,
+                string &error_msg_, JobJournal *journal = nullptr){
+    /* Same as above, with the results copied out.
+
+        Output:
+            stl_: string containing preprocessed mesh data in STL format. This can directly be saved as *.stl file
+            label_: segmentation labels corresponding to the output stl_
+            error_msg_: error message if job failed
+
+       NOTE: if return value is false, stl_, label_is meaningless, DO NOT USE!!!
+    */
+    SegOptions options;
+    options.journal = journal;
+
+    shared_ptr<const SegResult> result;
+    const string *mesh;
+    if (!segment_jaw(stl_file_path, jaw_type, result, error_msg_, options)) return false;
+    if (!result->mesh->get(mesh, error_msg_)) return false;
+    stl_ = *mesh;
+    label_ = result->label;
+    return true;
+}
+
+struct CaseResult {
+    shared_ptr<const SegResult> upper;
+    shared_ptr<const SegResult> lower;
+    double seconds = 0;
+};
+
+// This is a thread-safe function. You can start multiple threads and execute this function
+bool segment_case(const string &upper_stl_path, const string &lower_stl_path, CaseResult &result_,
+                  string &error_msg_, const SegOptions &options = SegOptions()){
+    /* Segments both jaws of one patient. The two jobs run concurrently, so the case takes
+       about as long as the slower jaw instead of the sum of both.
+
+        Output:
+            result_: upper / lower results and the wall time of the whole case
+            error_msg_: error message of every jaw that failed
+        Returns:
+            boolean: true only if both jaws succeeded. The case is all or nothing,
+                     on false result_ is meaningless, DO NOT USE!!!
+    */
+    auto start = now();
+
+    string lower_error;
+    bool lower_ok = false;
+    thread lower_thread([&]() {
+        lower_ok = segment_jaw(lower_stl_path, 'L', result_.lower, lower_error, options);
+    });
+
+    string upper_error;
+    bool upper_ok = segment_jaw(upper_stl_path, 'U', result_.upper, upper_error, options);
+    lower_thread.join();
+
+    result_.seconds = to_sec(now() - start);
+    cout << "case takes " << result_.seconds << " seconds" << endl;
+
+    if (!upper_ok || !lower_ok) {
+        error_msg_.clear();
+        if (!upper_ok) error_msg_ += "upper jaw: " + upper_error;
+        if (!upper_ok && !lower_ok) error_msg_ += "; ";
+        if (!lower_ok) error_msg_ += "lower jaw: " + lower_error;
+        return false;
     }
-    string stl_path = string(argv[1]);
-    char jaw_type = string(fs::path( stl_path ).filename())[0];
+    return true;
+}
+
+// Finds u.stl and l.stl (any case, or .ply) in a case directory
+bool find_case_files(const fs::path &case_dir, string &upper_stl_path, string &lower_stl_path){
+    if (!fs::is_directory(case_dir)) return false;
+    for (const auto &entry : fs::directory_iterator(case_dir)) {
+        string name = entry.path().filename().string();
+        if (name.size() != 5) continue;
+        for (auto &c : name) c = tolower(c);
+        if (name == "u.stl" || name == "u.ply") upper_stl_path = entry.path().string();
+        else if (name == "l.stl" || name == "l.ply") lower_stl_path = entry.path().string();
+    }
+    return !upper_stl_path.empty() && !lower_stl_path.empty();
+}
+
+// jaw type is the first character of the file name: u.stl for upper jaw, l.stl for lower jaw
+bool jaw_type_from_path(const string &stl_path, char &jaw_type){
+    jaw_type = string(fs::path( stl_path ).filename())[0];
 
     if(jaw_type == 'L' || jaw_type == 'l'){
         jaw_type = 'L';
     } else if (jaw_type == 'U' || jaw_type == 'u'){
         jaw_type = 'U';
     } else{
-        cout << "STL file name must be either u.stl for upper jaw or l.stl for lower jaw" << endl;
-        return 1;
+        return false;
     }
+    return true;
+}
 
-    string result_stl, error_msg;
-    vector<int> result_label;
+struct OutputOptions {
+    // also write result_label_original.txt: the labels moved onto the vertices of the input STL
+    bool original_labels = false;
+    // also write teeth/tooth_<label>.stl per tooth and teeth/gingiva.stl
+    bool split_teeth = false;
+    // also write tooth_stats.json: triangle count, area, centroid, bounding box and principal axes per label
+    bool tooth_stats = false;
+    // also write label_boundaries.bin: face labels and the lines between labels, see label_boundary.h
+    bool boundaries = false;
+    // > 0: connected regions of one label with fewer vertices take the label of
+    // their dominant neighbour, before anything is written
+    size_t min_island_vertices = 0;
+    // "stl" or "ply", for the meshes written locally
+    string mesh_type = "stl";
+    // write result.qmesh (see mesh_archive.h) instead of result_mesh.stl and result_label.txt
+    bool archive = false;
+    // write result_labeled.ply, the mesh with a per-vertex label property, instead
+    // of result_mesh.stl and result_label.txt
+    bool labeled_mesh = false;
+    // optional. Mesh and labels go into this pack as an archive under the
+    // result directory path, instead of into the directory
+    ResultPackWriter *pack = nullptr;
+    // optional. Result files are handed to this writer instead of being written
+    // by the calling thread
+    OutputWriter *writer = nullptr;
+};
 
-    if(!segment_jaw(stl_path, jaw_type, result_stl, result_label, error_msg)){
-        cout<< error_msg <<endl;
-        return 1;
+// The service returns a preprocessed mesh whose vertices differ from the input scan.
+// Each unique vertex of the input STL gets the label of the nearest result vertex.
+bool map_labels_to_original(const string &stl_file_path, const IndexedMesh &preprocessed, const vector<int> &label,
+                            vector<int> &labels_, string &error_msg_){
+    auto start = now();
+
+    string input, error_msg;
+    IndexedMesh original;
+    if (!read_file(stl_file_path, input, error_msg_)) return false;
+    if (!read_mesh(input, original, error_msg)) {
+        error_msg_ = "input mesh: " + error_msg;
+        return false;
     }
+    if (!transfer_labels(preprocessed.vertices, label, original.vertices, labels_, error_msg_)) return false;
 
-    auto result_dir_path = fs::path( string(argv[2]) );
+    cout << "label transfer takes " << to_sec(now() - start) << " seconds" << endl;
+    return true;
+}
 
-    if (!fs::is_directory(result_dir_path)) {
-        fs::create_directory(result_dir_path);
+// One label per line
+string labels_text(const vector<int> &labels){
+    string text;
+    text.reserve(labels.size() * 3);
+    for (const auto &e : labels) {
+        text += to_string(e);
+        text += '\n';
+    }
+    return text;
+}
+
+// Whole result files go through output.writer when there is one
+bool save_file(const OutputOptions &output, const fs::path &path, string data, string &error_msg_){
+    if (output.writer) {
+        output.writer->write(path.string(), move(data));
+        return true;
+    }
+    ofstream ofs(path, ofstream::out | ofstream::binary);
+    ofs << data;
+    if (!ofs) {
+        error_msg_ = "Could not write the file - '" + path.string() + "'";
+        return false;
     }
+    return true;
+}
+
+// result_mesh.stl (or .ply) is only written if the mesh was downloaded
+bool write_result(const fs::path &result_dir_path, const SegResult &result, const string &stl_file_path,
+                  const OutputOptions &output, string &error_msg_){
+    bool archive = output.archive || output.pack;
+    bool local_files = output.original_labels || output.split_teeth || output.tooth_stats || output.boundaries;
+    if (!fs::is_directory(result_dir_path) && (!output.pack || local_files)) {
+        fs::create_directories(result_dir_path);
+    }
+
+    // local post-processing works on the welded result mesh, parsed once
+    IndexedMesh preprocessed;
+    if (local_files || archive || output.labeled_mesh || output.min_island_vertices > 0) {
+        const string *mesh;
+        string error_msg;
+        if (!result.mesh->get(mesh, error_msg_)) return false;
+        if (!read_mesh(*mesh, preprocessed, error_msg)) {
+            error_msg_ = "result mesh: " + error_msg;
+            return false;
+        }
+    }
+
+    const vector<int> *labels = &result.label;
+    vector<int> cleaned;
+    if (output.min_island_vertices > 0) {
+        auto start = now();
+        cleaned = result.label;
+        LabelCleanupStats stats;
+        if (!clean_label_islands(preprocessed, cleaned, output.min_island_vertices, stats, error_msg_)) return false;
+        labels = &cleaned;
+        cout << "label cleanup: " << stats.components << " regions, " << stats.islands << " below "
+             << output.min_island_vertices << " vertices, " << stats.relabeled_islands << " islands ("
+             << stats.relabeled_vertices << " vertices) relabeled, takes " << to_sec(now() - start) << " seconds" << endl;
+    }
+
+    if (output.original_labels) {
+        vector<int> original_labels;
+        if (!map_labels_to_original(stl_file_path, preprocessed, *labels, original_labels, error_msg_)) return false;
+
+        if (!save_file(output, result_dir_path / "result_label_original.txt", labels_text(original_labels),
+                       error_msg_)) return false;
+    }
+
+    if (output.split_teeth) {
+        auto start = now();
+        vector<MeshPart> parts;
+        if (!split_by_label(preprocessed, *labels, parts, error_msg_) ||
+            !write_parts(parts, (result_dir_path / "teeth").string(), output.mesh_type, error_msg_)) return false;
+        cout << "splitting " << parts.size() << " parts takes " << to_sec(now() - start) << " seconds" << endl;
+    }
+
+    if (output.tooth_stats) {
+        auto start = now();
+        vector<ToothStats> stats;
+        if (!tooth_stats(preprocessed, *labels, stats, error_msg_)) return false;
+        if (!save_file(output, result_dir_path / "tooth_stats.json", tooth_stats_json(stats) + "\n",
+                       error_msg_)) return false;
+        cout << "statistics of " << stats.size() << " labels take " << to_sec(now() - start) << " seconds" << endl;
+    }
+
+    if (output.boundaries) {
+        auto start = now();
+        LabelBoundaries boundaries;
+        if (!extract_label_boundaries(preprocessed, *labels, boundaries, error_msg_)) return false;
+        ostringstream oss;
+        if (!write_label_boundaries(oss, boundaries, error_msg_) ||
+            !save_file(output, result_dir_path / "label_boundaries.bin", oss.str(), error_msg_)) return false;
+        cout << "extracting " << boundaries.lines.size() << " boundary lines takes " << to_sec(now() - start)
+             << " seconds" << endl;
+    }
+
+    if (output.pack) {
+        ostringstream oss;
+        return write_mesh_archive(oss, preprocessed, *labels, error_msg_) &&
+               output.pack->append(result_dir_path.string(), oss.str(), error_msg_);
+    }
+    if (output.archive && output.writer) {
+        ostringstream oss;
+        return write_mesh_archive(oss, preprocessed, *labels, error_msg_) &&
+               save_file(output, result_dir_path / "result.qmesh", oss.str(), error_msg_);
+    }
+    if (output.archive) {
+        ofstream ofs(result_dir_path / "result.qmesh", ofstream::out | ofstream::binary);
+        return write_mesh_archive(ofs, preprocessed, *labels, error_msg_);
+    }
+    if (output.labeled_mesh && output.writer) {
+        string ply;
+        return write_ply(preprocessed, ply, *labels, error_msg_) &&
+               save_file(output, result_dir_path / "result_labeled.ply", move(ply), error_msg_);
+    }
+    if (output.labeled_mesh) {
+        ofstream ofs(result_dir_path / "result_labeled.ply", ofstream::out | ofstream::binary);
+        return write_ply(ofs, preprocessed, labels, error_msg_);
+    }
+
+    const string *mesh;
+    string error_msg;
+    if (result.mesh->loaded() && result.mesh->get(mesh, error_msg)) {
+        // the writer gets a copy: the mesh stays cached for other jobs of the same input
+        if (!save_file(output, result_dir_path / (is_ply(*mesh) ? "result_mesh.ply" : "result_mesh.stl"), *mesh,
+                       error_msg_)) return false;
+    }
+    return save_file(output, result_dir_path / "result_label.txt", labels_text(*labels), error_msg_);
+}
+
+// Restores result_mesh.stl and result_label.txt from a result.qmesh or a pack record
+bool unpack_archive(istream &archive, const fs::path &result_dir_path, string &error_msg_){
+    IndexedMesh mesh;
+    vector<int> label;
+    if (!read_mesh_archive(archive, mesh, label, error_msg_)) return false;
 
-    ofstream ofs;
-    ofs.open (result_dir_path / "result_mesh.stl", ofstream::out | ofstream::binary);
-    ofs << result_stl;
+    if (!fs::is_directory(result_dir_path)) {
+        fs::create_directories(result_dir_path);
+    }
+    string stl;
+    write_stl(mesh, stl);
+    ofstream ofs(result_dir_path / "result_mesh.stl", ofstream::out | ofstream::binary);
+    ofs << stl;
     ofs.close();
 
-    ofs.open (result_dir_path / "result_label.txt", ofstream::out);
-    for (const auto &e : result_label) ofs << e << endl;
+    ofs.open(result_dir_path / "result_label.txt", ofstream::out);
+    for (const auto &e : label) ofs << e << endl;
     ofs.close();
+    return true;
+}
+
+// Fails on a transfer error as well as on an HTTP error status
+bool check_response(const cpr::Response &r, const string &request_name, string &error_msg_){
+    if (r.error) {
+        error_msg_ = request_name + " request failed: " + r.error.message;
+        return false;
+    }
+    if (r.status_code > 300) {
+        error_msg_ = request_name + " request failed with error code: " + to_string(r.status_code);
+        return false;
+    }
+    return true;
+}
+
+// ok, the result (null on failure) and the error message (empty on success)
+using SegCallback = function<void(bool, shared_ptr<const SegResult>, const string &)>;
+
+// Steps 1.1 - 5 of run_job for one mesh, as a chain of HttpEngine callbacks
+// and timers. Between steps the job is only this object: no thread waits for
+// its responses or sleeps between its status polls, so one event thread
+// carries any number of jobs. The steps, messages and journal records are
+// those of run_job.
+class AsyncSegJob : public enable_shared_from_this<AsyncSegJob> {
+public:
+    AsyncSegJob(HttpEngine &engine, string upload, uint64_t input_hash, char jaw_type, const SegOptions &options,
+                SegCallback done)
+        : engine_(engine), upload_(move(upload)), input_hash_(input_hash), jaw_type_(jaw_type),
+          options_(options), done_(move(done)) {}
+
+    AsyncSegJob(const AsyncSegJob &) = delete;
+    AsyncSegJob &operator=(const AsyncSegJob &) = delete;
+
+    // resumed: the journal entry of the job, if there is one. The job picks up
+    // after the steps it says are done.
+    void start(const JournalEntry *resumed){
+        if (resumed) {
+            urn_ = resumed->urn;
+            job_id_ = resumed->run_id;
+            if (!job_id_.empty()) cout << "resuming run id: " << job_id_ << endl;
+            if (resumed->state == "completed") return get_result();
+            if (!job_id_.empty()) return schedule_poll();
+            if (!urn_.empty()) return submit();
+        }
+        get_upload_url();
+    }
+
+private:
+    void record(const string &state){
+        if (options_.journal) options_.journal->record({input_hash_, jaw_type_, state, urn_, job_id_});
+    }
+
+    void request(const string &method, const string &url, cpr::Header header, string body,
+                 void (AsyncSegJob::*next)(cpr::Response)){
+        HttpRequest r;
+        r.method = method;
+        r.url = url;
+        r.header = move(header);
+        r.body = move(body);
+        auto self = shared_from_this();
+        engine_.submit(move(r), [self, next](cpr::Response response) { ((*self).*next)(move(response)); });
+    }
+
+    // Step 1.1 upload to file server
+    void get_upload_url(){
+        step_start_ = now();
+        request("GET", string(FILE_SERVER_URL) + "/scratch/APIClient/" + USER_ID + "/upload_url?postfix=" +
+                       options_.mesh_type, cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, "", &AsyncSegJob::upload);
+    }
+
+    void upload(cpr::Response r){
+        if (!check_response(r, "get upload_url", error_msg_)) return finish(false);
+        if (!unquote_upload_url(r.text, upload_url_, error_msg_)) return finish(false);
+        // the request owns the upload from here on
+        request("PUT", upload_url_, cpr::Header{{"content-type", ""}}, move(upload_), &AsyncSegJob::uploaded);
+    }
+
+    void uploaded(cpr::Response r){
+        if (!check_response(r, "file upload", error_msg_)) return finish(false);
+        cout << "uploading mesh takes " << to_sec(now() - step_start_) << " seconds" << endl;
+        if (!urn_from_upload_url(upload_url_, urn_, error_msg_)) return finish(false);
+        cout << "Uploaded to urn: " << urn_ << endl;
+        record("uploaded");
+        submit();
+    }
 
-    return 0;
-}
\ No newline at end of file
+    // Step 2. submit job
+    void submit(){
+        Document input_data(kObjectType);
+        add_seg_input(input_data, urn_, jaw_type_, options_.mesh_type);
+        request("POST", string(SERVER_URL) + "/run",
+                cpr::Header{{"Content-Type", "application/json"}, {"X-ZH-TOKEN", USER_TOKEN}},
+                job_request_body(SEG_SPEC, input_data, options_.mesh_type), &AsyncSegJob::submitted);
+    }
+
+    void submitted(cpr::Response r){
+        if (!check_response(r, "job creation", error_msg_)) return finish(false);
+        if (!parse_run_id(r.text, job_id_, error_msg_)) return finish(false);
+        cout << "run id is: " << job_id_ << endl;
+        record("submitted");
+        schedule_poll();
+    }
+
+    // Step 3. check job, every 3s
+    void schedule_poll(){
+        step_start_ = now();
+        poll_after_wait();
+    }
+
+    void poll_after_wait(){
+        auto self = shared_from_this();
+        engine_.schedule(chrono::milliseconds(3000), [self]() {
+            self->request("GET", string(SERVER_URL) + "/run/" + self->job_id_, cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}},
+                          "", &AsyncSegJob::polled);
+        });
+    }
+
+    void polled(cpr::Response r){
+        bool completed = false, job_failed = false;
+        if (!check_response(r, "job status", error_msg_)) return finish(false);
+        if (!parse_job_status(r.text, completed, job_failed, error_msg_)) {
+            if (job_failed) record("failed");
+            return finish(false);
+        }
+        if (!completed) return poll_after_wait();
+        cout << "job run takes " << to_sec(now() - step_start_) << " seconds" << endl;
+        record("completed");
+        get_result();
+    }
+
+    // Step 4. get job result and Step 5. parse result
+    void get_result(){
+        request("GET", string(SERVER_URL) + "/data/" + job_id_, cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, "",
+                &AsyncSegJob::got_result);
+    }
+
+    void got_result(cpr::Response r){
+        if (!check_response(r, "job result", error_msg_)) return finish(false);
+        Document document_result;
+        document_result.Parse(r.text.c_str());
+        if (!read_result(document_result, result_, result_mesh_urn_, error_msg_)) return finish(false);
+        if (options_.lazy_mesh) {
+            result_.mesh = make_shared<LazyMesh>(result_mesh_urn_);
+            return fetched();
+        }
+        // Step 5.1 download mesh
+        request("GET", string(FILE_SERVER_URL) + "/file/download?urn=" + result_mesh_urn_,
+                cpr::Header{{"X-ZH-TOKEN", USER_TOKEN}}, "", &AsyncSegJob::downloaded);
+    }
+
+    void downloaded(cpr::Response r){
+        if (!check_response(r, "mesh download", error_msg_)) return finish(false);
+        result_.mesh = make_shared<LazyMesh>(result_mesh_urn_, move(r.text));
+        fetched();
+    }
+
+    void fetched(){
+        record("fetched");
+        finish(true);
+    }
+
+    void finish(bool ok){
+        shared_ptr<const SegResult> result;
+        if (ok) result = make_shared<SegResult>(move(result_));
+        done_(ok, result, ok ? "" : error_msg_);
+    }
+
+    HttpEngine &engine_;
+    string upload_;
+    uint64_t input_hash_;
+    char jaw_type_;
+    SegOptions options_;
+    SegCallback done_;
+
+    string upload_url_;
+    string urn_;
+    string job_id_;
+    string result_mesh_urn_;
+    SegResult result_;
+    string error_msg_;
+    chrono::time_point<chrono::high_resolution_clock> step_start_;
+};
+
+// This is a thread-safe function. It returns once the job is started; done
+// runs on the engine's event thread when the job is over and must not block.
+void segment_jaw_async(HttpEngine &engine, const string &stl_file_path, char jaw_type, const SegOptions &options,
+                       SegCallback done){
+    /* Same job as segment_jaw, without a thread blocked for its whole life.
+       Step 1 (reading, hashing and preparing the mesh) runs on the calling
+       thread, the network steps on the engine.
+
+       Unlike segment_jaw, identical concurrent submissions are not merged into
+       one cloud job and options.memory_stats is ignored: the job's memory is
+       allocated on whichever thread runs its step.
+    */
+    string buffer, prepared, error_msg;
+    if (!read_file(stl_file_path, buffer, error_msg)) return done(false, nullptr, error_msg);
+
+    uint64_t input_hash = job_input_hash(buffer, options);
+    JournalEntry entry;
+    bool resumed = options.journal && options.journal->lookup(input_hash, jaw_type, entry);
+    if (!resumed || entry.urn.empty()) {
+        if (!prepare_upload(buffer, options, prepared, error_msg)) return done(false, nullptr, error_msg);
+        if (!prepared.empty()) buffer = move(prepared);
+    } else {
+        buffer.clear();
+    }
+    make_shared<AsyncSegJob>(engine, move(buffer), input_hash, jaw_type, options, move(done))
+        ->start(resumed ? &entry : nullptr);
+}
+
+// Bounds the jobs started on an event loop and still running, by count and by
+// estimated memory (0 for no bound). A single job over the memory budget still
+// runs, alone.
+// This is a thread-safe class.
+class InFlightLimit {
+public:
+    InFlightLimit(size_t max_jobs, size_t memory_budget) : max_jobs_(max_jobs), memory_budget_(memory_budget) {}
+
+    InFlightLimit(const InFlightLimit &) = delete;
+    InFlightLimit &operator=(const InFlightLimit &) = delete;
+
+    // Blocks until the job fits
+    void enter(size_t memory){
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [&]() {
+            return jobs_ == 0 || ((max_jobs_ == 0 || jobs_ < max_jobs_) &&
+                                  (memory_budget_ == 0 || memory_ + memory <= memory_budget_));
+        });
+        ++jobs_;
+        memory_ += memory;
+    }
+
+    void leave(size_t memory){
+        lock_guard<mutex> lock(mutex_);
+        --jobs_;
+        memory_ -= memory;
+        cv_.notify_all();
+    }
+
+    void wait_empty(){
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return jobs_ == 0; });
+    }
+
+private:
+    size_t max_jobs_;
+    size_t memory_budget_;
+    mutex mutex_;
+    condition_variable cv_;
+    size_t jobs_ = 0;
+    size_t memory_ = 0;
+};
+
+// Rough peak memory of one job from the size of its input: the file buffer,
+// the prepared upload and request body, the result mesh in the response, its
+// JSON document and copies, and the parsed meshes of local post-processing.
+// Check against --memory-stats when the pipeline changes.
+size_t estimate_job_memory(const string &stl_path){
+    const size_t kBase = size_t(16) << 20;
+    const size_t kPerInputByte = 8;
+    error_code ec;
+    uintmax_t size = fs::file_size(stl_path, ec);
+    return kBase + (ec ? 0 : size_t(size) * kPerInputByte);
+}
+
+// Each manifest line is: PATH_TO_STL PATH_TO_RESULT_DIR [interactive|bulk]
+// Interactive lines are started before any queued bulk line. With a memory
+// budget (bytes, 0 for none), jobs only start while their estimated memory fits.
+//
+// With an event_loop, workers only prepare jobs and start them on it, up to
+// max_in_flight (0 for no bound) at once; their network steps run on its one
+// event thread. Results are written on a second pool of workers, which never
+// waits for admission. The memory budget then covers a job from preparation
+// to its written result.
+int run_batch(const string &manifest_path, size_t workers, size_t reserve_interactive, size_t memory_budget,
+              const SegOptions &options, const OutputOptions &output, HttpEngine *event_loop = nullptr,
+              size_t max_in_flight = 0){
+    ifstream manifest(manifest_path);
+    if (!manifest.is_open()) {
+        cout << "Could not open the manifest - '" << manifest_path << "'" << endl;
+        return 1;
+    }
+
+    // workers hand their results over and go back to the network; the disk is
+    // left to the writer
+    OutputWriter writer;
+    OutputOptions batch_output = output;
+    batch_output.writer = &writer;
+
+    JobScheduler scheduler(workers, {reserve_interactive, 0}, event_loop ? 0 : memory_budget);
+    unique_ptr<JobScheduler> post_processing;
+    if (event_loop) post_processing.reset(new JobScheduler(workers));
+    InFlightLimit in_flight(max_in_flight, memory_budget);
+    mutex failed_mutex;
+    size_t failed = 0;
+
+    string line;
+    while (getline(manifest, line)) {
+        stringstream ss(line);
+        string stl_path, result_dir, priority_name = "bulk";
+        if (!(ss >> stl_path >> result_dir)) continue;
+        ss >> priority_name;
+
+        Priority priority;
+        char jaw_type;
+        if (!parse_priority(priority_name, priority) || !jaw_type_from_path(stl_path, jaw_type)) {
+            cout << "skipping manifest line: " << line << endl;
+            lock_guard<mutex> lock(failed_mutex);
+            ++failed;
+            continue;
+        }
+
+        if (event_loop) {
+            size_t memory = estimate_job_memory(stl_path);
+            JobScheduler *post = post_processing.get();
+            scheduler.submit(priority, [=, &batch_output, &in_flight, &failed_mutex, &failed]() {
+                in_flight.enter(memory);
+                segment_jaw_async(*event_loop, stl_path, jaw_type, options,
+                                  [=, &batch_output, &in_flight, &failed_mutex, &failed](
+                                      bool ok, shared_ptr<const SegResult> result, const string &error_msg) {
+                    // failed is updated before leave(): once the last job
+                    // leaves, run_batch may read it and return
+                    if (!ok) {
+                        cout << stl_path << ": " << error_msg << endl;
+                        {
+                            lock_guard<mutex> lock(failed_mutex);
+                            ++failed;
+                        }
+                        in_flight.leave(memory);
+                        return;
+                    }
+                    post->submit(priority, [=, &batch_output, &in_flight, &failed_mutex, &failed]() {
+                        string error_msg;
+                        bool written = write_result(fs::path(result_dir), *result, stl_path, batch_output, error_msg);
+                        if (!written) cout << stl_path << ": " << error_msg << endl;
+                        {
+                            lock_guard<mutex> lock(failed_mutex);
+                            failed += !written;
+                        }
+                        in_flight.leave(memory);
+                    });
+                });
+            });
+            continue;
+        }
+
+        scheduler.submit(priority, [=, &batch_output, &failed_mutex, &failed]() {
+            shared_ptr<const SegResult> result;
+            string error_msg;
+            if (!segment_jaw(stl_path, jaw_type, result, error_msg, options)) {
+                cout << stl_path << ": " << error_msg << endl;
+                lock_guard<mutex> lock(failed_mutex);
+                ++failed;
+                return;
+            }
+            if (!write_result(fs::path(result_dir), *result, stl_path, batch_output, error_msg)) {
+                cout << stl_path << ": " << error_msg << endl;
+                lock_guard<mutex> lock(failed_mutex);
+                ++failed;
+            }
+        }, estimate_job_memory(stl_path));
+    }
+
+    scheduler.wait_idle();
+    in_flight.wait_empty();
+    scheduler.print_stats(cout);
+    string error_msg;
+    bool flushed = writer.flush(error_msg);
+    if (!flushed) cout << error_msg << endl;
+    writer.print_stats(cout);
+    lock_guard<mutex> lock(failed_mutex);
+    return failed || !flushed ? 1 : 0;
+}
+
+struct TraceEntry {
+    double at = 0;          // seconds after the start of the trace
+    size_t size = 0;        // input file bytes
+    double duration = 0;    // seconds the cloud job ran
+    char jaw_type = 'U';
+    Priority priority = Priority::Bulk;
+};
+
+// One JSON object per line: {"at": 12.5, "size": 31457280, "duration": 41.2,
+// "jaw": "U", "priority": "bulk"}. jaw and priority are optional.
+bool read_trace(const string &trace_path, vector<TraceEntry> &entries_, string &error_msg_){
+    ifstream trace(trace_path);
+    if (!trace.is_open()) {
+        error_msg_ = "Could not open the trace - '" + trace_path + "'";
+        return false;
+    }
+    string line;
+    size_t line_number = 0;
+    while (getline(trace, line)) {
+        ++line_number;
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        Document doc;
+        doc.Parse(line.c_str());
+        TraceEntry e;
+        bool ok = !doc.HasParseError() && doc.IsObject() && doc.HasMember("at") && doc["at"].IsNumber() &&
+                  doc.HasMember("size") && doc["size"].IsNumber();
+        if (ok) {
+            e.at = doc["at"].GetDouble();
+            e.size = size_t(doc["size"].GetDouble());
+            if (doc.HasMember("duration") && doc["duration"].IsNumber()) e.duration = doc["duration"].GetDouble();
+            if (doc.HasMember("jaw") && doc["jaw"].IsString()) e.jaw_type = char(toupper(doc["jaw"].GetString()[0]));
+            if (doc.HasMember("priority") && doc["priority"].IsString())
+                ok = parse_priority(doc["priority"].GetString(), e.priority);
+            ok = ok && (e.jaw_type == 'U' || e.jaw_type == 'L');
+        }
+        if (!ok) {
+            error_msg_ = "bad trace line " + to_string(line_number) + ": " + line;
+            return false;
+        }
+        entries_.push_back(e);
+    }
+    sort(entries_.begin(), entries_.end(), [](const TraceEntry &a, const TraceEntry &b) { return a.at < b.at; });
+    return true;
+}
+
+// An STL-shaped file of the recorded size. The header carries the recorded job
+// duration for stand_in_service and makes every input distinct, so replayed
+// jobs are not merged by the in-flight or journal deduplication.
+bool write_replay_input(const string &path, size_t index, const TraceEntry &entry, string &error_msg_){
+    string data(max<size_t>(entry.size, 84), '\0');
+    string header = "seg replay id=" + to_string(index) +
+                    " duration_ms=" + to_string(long(entry.duration * 1000 + 0.5));
+    copy(header.begin(), header.end(), data.begin());
+    uint32_t triangles = uint32_t((data.size() - 84) / 50);
+    memcpy(&data[80], &triangles, 4);
+
+    ofstream ofs(path, ofstream::out | ofstream::binary);
+    ofs << data;
+    if (!ofs) {
+        error_msg_ = "Could not write the file - '" + path + "'";
+        return false;
+    }
+    return true;
+}
+
+double percentile(const vector<double> &sorted, double q){
+    if (sorted.empty()) return 0;
+    return sorted[min(sorted.size() - 1, size_t(sorted.size() * q))];
+}
+
+void print_percentiles(const string &name, vector<double> values){
+    sort(values.begin(), values.end());
+    cout << name << ": p50 " << percentile(values, 0.5) << "s p95 " << percentile(values, 0.95) << "s p99 "
+         << percentile(values, 0.99) << "s max " << (values.empty() ? 0 : values.back()) << "s" << endl;
+}
+
+// Replays a recorded trace through segment_jaw, against stand_in_service or
+// a real service. Arrivals follow the recorded times divided by rate; inputs
+// are synthesized at the recorded sizes and deleted after their job. With an
+// event_loop, jobs run through segment_jaw_async as in run_batch.
+int run_replay(const string &trace_path, double rate, size_t workers, size_t reserve_interactive,
+               size_t memory_budget, const SegOptions &options, HttpEngine *event_loop = nullptr,
+               size_t max_in_flight = 0){
+    vector<TraceEntry> entries;
+    string error_msg;
+    if (!read_trace(trace_path, entries, error_msg)) {
+        cout << error_msg << endl;
+        return 1;
+    }
+    fs::path input_dir = fs::temp_directory_path() / ("seg_replay_" + to_string(getpid()));
+
+    struct JobTiming {
+        double arrival = 0;   // seconds after the replay started
+        double start = 0;
+        double end = 0;
+        bool ok = false;
+    };
+    vector<JobTiming> timings(entries.size());
+    double max_lag = 0;
+
+    auto replay_start = now();
+    auto since_start = [&]() { return chrono::duration<double>(now() - replay_start).count(); };
+    // on an error the loop stops submitting, but still waits for the jobs
+    // already submitted: they use the scheduler, the limit and timings
+    bool aborted = false;
+    {
+        JobScheduler scheduler(workers, {reserve_interactive, 0}, event_loop ? 0 : memory_budget);
+        InFlightLimit in_flight(max_in_flight, memory_budget);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const TraceEntry &entry = entries[i];
+            // Step 1. wait for the recorded arrival time
+            double due = entry.at / rate;
+            this_thread::sleep_until(replay_start + chrono::duration_cast<chrono::high_resolution_clock::duration>(
+                                                        chrono::duration<double>(due)));
+
+            // Step 2. make the input and submit
+            fs::path dir = input_dir / to_string(i);
+            error_code ec;
+            fs::create_directories(dir, ec);
+            string stl_path = (dir / (entry.jaw_type == 'L' ? "l.stl" : "u.stl")).string();
+            if (!write_replay_input(stl_path, i, entry, error_msg)) {
+                cout << error_msg << endl;
+                aborted = true;
+                break;
+            }
+            timings[i].arrival = since_start();
+            max_lag = max(max_lag, timings[i].arrival - due);
+
+            if (event_loop) {
+                size_t memory = estimate_job_memory(stl_path);
+                scheduler.submit(entry.priority, [&, i, stl_path, dir, memory]() {
+                    in_flight.enter(memory);
+                    timings[i].start = since_start();
+                    segment_jaw_async(*event_loop, stl_path, entries[i].jaw_type, options,
+                                      [&, i, stl_path, dir, memory](bool ok, shared_ptr<const SegResult>,
+                                                                    const string &error_msg) {
+                        JobTiming &t = timings[i];
+                        t.ok = ok;
+                        if (!ok) cout << stl_path << ": " << error_msg << endl;
+                        t.end = since_start();
+                        error_code ec;
+                        fs::remove_all(dir, ec);
+                        in_flight.leave(memory);
+                    });
+                });
+                continue;
+            }
+
+            scheduler.submit(entry.priority, [&, i, stl_path, dir]() {
+                JobTiming &t = timings[i];
+                t.start = since_start();
+                shared_ptr<const SegResult> result;
+                string error_msg;
+                t.ok = segment_jaw(stl_path, entries[i].jaw_type, result, error_msg, options);
+                if (!t.ok) cout << stl_path << ": " << error_msg << endl;
+                t.end = since_start();
+                error_code ec;
+                fs::remove_all(dir, ec);
+            }, memory_budget ? estimate_job_memory(stl_path) : 0);
+        }
+        scheduler.wait_idle();
+        in_flight.wait_empty();
+        scheduler.print_stats(cout);
+    }
+    error_code ec;
+    fs::remove_all(input_dir, ec);
+    if (aborted) return 1;
+
+    // Step 3. report
+    vector<double> waits, latencies;
+    size_t failed = 0, bytes = 0;
+    double first = timings.empty() ? 0 : timings.front().arrival, last = first;
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const JobTiming &t = timings[i];
+        waits.push_back(t.start - t.arrival);
+        last = max(last, t.end);
+        if (!t.ok) {
+            ++failed;
+            continue;
+        }
+        latencies.push_back(t.end - t.arrival);
+        bytes += entries[i].size;
+    }
+    double span = max(last - first, 1e-9);
+    cout << "replayed " << entries.size() << " jobs at " << rate << "x, " << failed << " failed, in " << span
+         << " seconds" << endl;
+    cout << "throughput: " << latencies.size() / span << " jobs/s, " << double(bytes) / (1 << 20) / span
+         << " MB/s of input; arrivals lagged the trace by up to " << max_lag << "s" << endl;
+    print_percentiles("queue wait", waits);
+    print_percentiles("latency", latencies);
+    return failed ? 1 : 0;
+}
+
+int main(int argc,char *argv[]){
+    vector<string> args;
+    string journal_path, manifest_path, pack_path, trace_path;
+    double rate = 1;
+    bool case_mode = false, unpack_mode = false;
+    SegOptions options;
+    OutputOptions output;
+    size_t workers = 4, reserve_interactive = 1, memory_budget = 0, warm_up_connections = 0;
+    long http2_connections = 0;
+    bool event_loop = false;
+    size_t max_in_flight = 1024;
+    vector<JobStep> then_steps;
+    for (int i = 1; i < argc; ++i) {
+        string arg = string(argv[i]);
+        if (arg.rfind("--journal=", 0) == 0) journal_path = arg.substr(10);
+        else if (arg.rfind("--batch=", 0) == 0) manifest_path = arg.substr(8);
+        else if (arg.rfind("--replay=", 0) == 0) trace_path = arg.substr(9);
+        else if (arg.rfind("--rate=", 0) == 0) rate = stod(arg.substr(7));
+        else if (arg == "--case") case_mode = true;
+        else if (arg == "--unpack") unpack_mode = true;
+        else if (arg == "--archive") output.archive = true;
+        else if (arg == "--labeled-ply") output.labeled_mesh = true;
+        else if (arg.rfind("--pack=", 0) == 0) pack_path = arg.substr(7);
+        else if (arg == "--labels-only") options.lazy_mesh = true;
+        else if (arg == "--original-labels") output.original_labels = true;
+        else if (arg == "--split-teeth") output.split_teeth = true;
+        else if (arg == "--tooth-stats") output.tooth_stats = true;
+        else if (arg == "--boundaries") output.boundaries = true;
+        else if (arg.rfind("--clean-islands=", 0) == 0) output.min_island_vertices = stoul(arg.substr(16));
+        else if (arg.rfind("--decimate=", 0) == 0) {
+            options.decimate_triangles = stoul(arg.substr(11));
+            output.original_labels = true;
+        }
+        else if (arg == "--mesh-type=ply" || arg == "--mesh-type=stl") options.mesh_type = output.mesh_type = arg.substr(12);
+        else if (arg == "--check=reject") options.check = MeshCheck::Reject;
+        else if (arg == "--check=repair") options.check = MeshCheck::Repair;
+        else if (arg == "--memory-stats") options.memory_stats = true;
+        else if (arg == "--warm-up") warm_up_connections = 2;
+        else if (arg.rfind("--warm-up=", 0) == 0) warm_up_connections = stoul(arg.substr(10));
+        else if (arg == "--http2") http2_connections = 2;
+        else if (arg.rfind("--http2=", 0) == 0) http2_connections = stol(arg.substr(8));
+        else if (arg.rfind("--then=", 0) == 0) {
+            JobStep step;
+            string error_msg;
+            if (!parse_job_step(arg.substr(7), step, error_msg)) {
+                cout << error_msg << endl;
+                return 1;
+            }
+            then_steps.push_back(step);
+        }
+        else if (arg == "--event-loop") event_loop = true;
+        else if (arg.rfind("--event-loop=", 0) == 0) {
+            event_loop = true;
+            max_in_flight = stoul(arg.substr(13));
+        }
+        else if (arg.rfind("--workers=", 0) == 0) workers = stoul(arg.substr(10));
+        else if (arg.rfind("--reserve-interactive=", 0) == 0) reserve_interactive = stoul(arg.substr(22));
+        else if (arg.rfind("--memory-budget=", 0) == 0) memory_budget = size_t(stoul(arg.substr(16))) << 20;
+        else args.push_back(arg);
+    }
+
+    if(args.size() < 2 && manifest_path.empty() && trace_path.empty()) {
+        cout << "Usage: ./seg PATH_TO_STL PATH_TO_RESULT_DIR [OPTIONS]" << endl;
+        cout << "       ./seg --case PATH_TO_CASE_DIR PATH_TO_RESULT_DIR [OPTIONS]" << endl;
+        cout << "       ./seg --batch=PATH_TO_MANIFEST [--workers=N] [--reserve-interactive=N] [--memory-budget=MB] [OPTIONS]" << endl;
+        cout << "       ./seg --replay=PATH_TO_TRACE [--rate=X] [--workers=N] [--reserve-interactive=N] [--memory-budget=MB] [OPTIONS]" << endl;
+        cout << "       ./seg --unpack PATH_TO_QMESH PATH_TO_RESULT_DIR" << endl;
+        cout << "       ./seg --unpack --pack=PATH_TO_PACK CASE_ID PATH_TO_RESULT_DIR" << endl;
+        cout << "Options: --journal=PATH_TO_JOURNAL --labels-only --original-labels --split-teeth --tooth-stats"
+             << " --boundaries --clean-islands=N --check=reject|repair --mesh-type=stl|ply --decimate=N --archive --labeled-ply"
+             << " --pack=PATH_TO_PACK --memory-stats --warm-up[=N] --http2[=N] --event-loop[=N]"
+             << " --then=GROUP/NAME/VERSION[,INPUT_JSON]" << endl;
+        return 1;
+    }
+
+    string error_msg;
+
+    if (unpack_mode) {
+        ResultPackReader reader;
+        const char *payload;
+        size_t size;
+        if (!pack_path.empty()) {
+            if (!reader.open(pack_path, error_msg)) {
+                cout << error_msg << endl;
+                return 1;
+            }
+            if (!reader.find(args[0], payload, size)) {
+                cout << "case '" << args[0] << "' is not in the pack" << endl;
+                return 1;
+            }
+        }
+        ifstream ifs;
+        istringstream iss;
+        if (pack_path.empty()) {
+            ifs.open(args[0], ifstream::binary);
+            if (!ifs.is_open()) {
+                cout << "Could not open the file - '" << args[0] << "'" << endl;
+                return 1;
+            }
+        } else {
+            iss.str(string(payload, size));
+        }
+        if (!unpack_archive(pack_path.empty() ? static_cast<istream &>(ifs) : iss, fs::path(args[1]), error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    unique_ptr<ResultPackWriter> pack;
+    if (!pack_path.empty()) {
+        pack.reset(new ResultPackWriter(pack_path));
+        if (!pack->open(error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        output.pack = pack.get();
+    }
+    unique_ptr<JobJournal> journal;
+    if (!journal_path.empty()) {
+        journal.reset(new JobJournal(journal_path));
+        if (!journal->open(error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        cout << journal->pending().size() << " unfinished job(s) in journal" << endl;
+        options.journal = journal.get();
+    }
+
+    // the pack index is only written on success; records of a failed run are
+    // picked up again when the pack is next opened. A journal that could not be
+    // written fails the run, as its jobs would not be resumed.
+    auto close_outputs = [&]() {
+        if (pack && !pack->close(error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        if (journal && !journal->flush(error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        return 0;
+    };
+
+    // --http2 multiplexes the control requests; --event-loop runs whole batch
+    // and replay jobs on the same engine
+    unique_ptr<HttpEngine> engine;
+    if (http2_connections > 0) {
+        engine.reset(new HttpEngine(true, http2_connections));
+        control_engine = engine.get();
+    } else if (event_loop) {
+        engine.reset(new HttpEngine(false, HttpEngine::kHttp1Connections));
+    }
+    HttpEngine *job_engine = event_loop ? engine.get() : nullptr;
+
+    if (warm_up_connections > 0) {
+        WarmupReport warm_up = http_sessions.warm_up({SERVER_URL, FILE_SERVER_URL}, warm_up_connections);
+        cout << "warm-up of " << warm_up.connections << " connections to " << warm_up.hosts << " hosts takes "
+             << warm_up.seconds << " seconds, saves about " << (warm_up.cold_request - warm_up.warm_request) * 1000
+             << " ms on each first request (" << warm_up.cold_request * 1000 << " ms cold, "
+             << warm_up.warm_request * 1000 << " ms warm)" << endl;
+    }
+
+    if (!trace_path.empty()) {
+        int status = run_replay(trace_path, rate, workers, reserve_interactive, memory_budget, options, job_engine,
+                                max_in_flight);
+        if (engine) engine->print_stats(cout);
+        return close_outputs() ? 1 : status;
+    }
+
+    if (!manifest_path.empty()) {
+        int status = run_batch(manifest_path, workers, reserve_interactive, memory_budget, options, output,
+                               job_engine, max_in_flight);
+        if (engine) engine->print_stats(cout);
+        return close_outputs() ? 1 : status;
+    }
+
+    if (case_mode) {
+        string upper_stl_path, lower_stl_path;
+        if (!find_case_files(fs::path(args[0]), upper_stl_path, lower_stl_path)) {
+            cout << "case directory must contain both u.stl and l.stl (or .ply)" << endl;
+            return 1;
+        }
+
+        CaseResult case_result;
+        if (!segment_case(upper_stl_path, lower_stl_path, case_result, error_msg, options)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+
+        if (!write_result(fs::path( args[1] ) / "upper", *case_result.upper, upper_stl_path, output, error_msg) ||
+            !write_result(fs::path( args[1] ) / "lower", *case_result.lower, lower_stl_path, output, error_msg)) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        return close_outputs();
+    }
+
+    string stl_path = args[0];
+    char jaw_type;
+    if (!jaw_type_from_path(stl_path, jaw_type)) {
+        cout << "STL file name must be either u.stl for upper jaw or l.stl for lower jaw" << endl;
+        return 1;
+    }
+
+    shared_ptr<const SegResult> result;
+
+    if(!segment_jaw(stl_path, jaw_type, result, error_msg, options)){
+        cout<< error_msg <<endl;
+        return 1;
+    }
+
+    if (!write_result(fs::path( args[1] ), *result, stl_path, output, error_msg)) {
+        cout << error_msg << endl;
+        return 1;
+    }
+
+    // follow-on jobs start from the result mesh where it lies on the file server
+    if (!then_steps.empty()) {
+        for (auto &step : then_steps) step.output_mesh_type = options.mesh_type;
+        vector<StepResult> step_results;
+        error_code ec;
+        fs::create_directories(fs::path(args[1]), ec);
+        bool chained = run_job_chain(result->mesh->urn(), options.mesh_type, then_steps, step_results, error_msg);
+        for (size_t i = 0; i < step_results.size(); ++i) {
+            string step_error;
+            if (!save_file(output, fs::path(args[1]) / ("step_" + to_string(i) + ".json"),
+                           step_results[i].result_json + "\n", step_error)) cout << step_error << endl;
+        }
+        if (!chained) {
+            cout << error_msg << endl;
+            return 1;
+        }
+        cout << "last step output mesh: " << step_results.back().mesh_urn << endl;
+    }
+
+    return close_outputs();
+}
@@ -0,0 +1,153 @@
+#include "session_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// scheme://host[:port] of url
+string origin_of(const string &url)
+{
+  size_t scheme = url.find("://");
+  size_t start = scheme == string::npos ? 0 : scheme + 3;
+  return url.substr(0, url.find('/', start));
+}
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void prepare(cpr::Session &session, const string &url, const cpr::Header &header)
+{
+  session.SetUrl(cpr::Url{url});
+  session.SetHeader(header);
+  session.SetVerifySsl(cpr::VerifySsl(0)); // do not add this line in production for safty reason
+}
+
+} // namespace
+
+SessionPool::SessionPool(size_t max_idle) : max_idle_(max_idle)
+{
+}
+
+unique_ptr<cpr::Session> SessionPool::acquire(const string &origin)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto &idle = idle_[origin];
+        if (!idle.empty()) {
+            unique_ptr<cpr::Session> session = move(idle.back());
+            idle.pop_back();
+            return session;
+        }
+    }
+    return unique_ptr<cpr::Session>(new cpr::Session());
+}
+
+void SessionPool::release(const string &origin, unique_ptr<cpr::Session> session)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto &idle = idle_[origin];
+    if (idle.size() < max_idle_) idle.push_back(move(session));
+}
+
+cpr::Response SessionPool::get(const string &url, const cpr::Header &header)
+{
+    string origin = origin_of(url);
+    auto session = acquire(origin);
+    prepare(*session, url, header);
+    cpr::Response r = session->Get();
+    // a failed transfer may leave the connection in any state
+    if (!r.error) release(origin, move(session));
+    return r;
+}
+
+cpr::Response SessionPool::put(const string &url, const string &body, const cpr::Header &header)
+{
+    string origin = origin_of(url);
+    auto session = acquire(origin);
+    prepare(*session, url, header);
+    session->SetBody(cpr::Body{body});
+    cpr::Response r = session->Put();
+    // do not keep a copy of the upload alive in the idle session
+    session->SetBody(cpr::Body{""});
+    if (!r.error) release(origin, move(session));
+    return r;
+}
+
+cpr::Response SessionPool::post(const string &url, const string &body, const cpr::Header &header)
+{
+    string origin = origin_of(url);
+    auto session = acquire(origin);
+    prepare(*session, url, header);
+    session->SetBody(cpr::Body{body});
+    cpr::Response r = session->Post();
+    session->SetBody(cpr::Body{""});
+    if (!r.error) release(origin, move(session));
+    return r;
+}
+
+WarmupReport SessionPool::warm_up(const vector<string> &base_urls, size_t connections)
+{
+    WarmupReport report;
+    auto start = chrono::steady_clock::now();
+
+    // the two urls are often the same host, which then gets one set of connections
+    vector<string> origins;
+    for (const auto &url : base_urls) {
+        string origin = origin_of(url);
+        if (find(origins.begin(), origins.end(), origin) == origins.end()) origins.push_back(origin);
+    }
+
+    // Step 1. cold requests, all connections of all hosts at once
+    size_t n = origins.size() * connections;
+    vector<unique_ptr<cpr::Session>> sessions(n);
+    vector<double> cold(n, 0);
+    vector<char> ok(n, false); // not vector<bool>: every thread writes its own entry
+    vector<thread> threads;
+    for (size_t i = 0; i < n; ++i) {
+        threads.emplace_back([&, i] {
+            sessions[i].reset(new cpr::Session());
+            prepare(*sessions[i], origins[i / connections] + "/", cpr::Header{});
+            auto t = chrono::steady_clock::now();
+            ok[i] = !sessions[i]->Head().error;
+            cold[i] = seconds_since(t);
+        });
+    }
+    for (auto &t : threads) t.join();
+
+    // Step 2. the same request again on an open connection of each host
+    size_t warm_count = 0, cold_count = 0;
+    for (size_t h = 0; h < origins.size(); ++h) {
+        for (size_t c = 0; c < connections; ++c) {
+            size_t i = h * connections + c;
+            if (!ok[i]) continue;
+            report.cold_request += cold[i];
+            ++cold_count;
+            ++report.connections;
+        }
+        for (size_t c = 0; c < connections; ++c) {
+            size_t i = h * connections + c;
+            if (!ok[i]) continue;
+            auto t = chrono::steady_clock::now();
+            ok[i] = !sessions[i]->Head().error;
+            if (ok[i]) {
+                report.warm_request += seconds_since(t);
+                ++warm_count;
+            }
+            break;
+        }
+    }
+    if (cold_count) report.cold_request /= cold_count;
+    if (warm_count) report.warm_request /= warm_count;
+
+    for (size_t i = 0; i < n; ++i)
+        if (ok[i]) release(origins[i / connections], move(sessions[i]));
+    report.hosts = origins.size();
+    report.seconds = seconds_since(start);
+    return report;
+}
@@ -0,0 +1,51 @@
+#ifndef DA_SEG_SESSION_POOL_H
+#define DA_SEG_SESSION_POOL_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cpr/cpr.h>
+
+struct WarmupReport {
+    size_t hosts = 0;
+    size_t connections = 0;
+    double seconds = 0;       // wall time of the whole warm-up
+    double cold_request = 0;  // mean seconds of a request on a new connection: DNS, connect, TLS
+    double warm_request = 0;  // mean seconds of the same request on an open connection
+};
+
+// Keeps cpr sessions, and with them libcurl's open connections and DNS cache,
+// between requests. A request borrows an idle session of its origin
+// (scheme://host:port) if there is one and returns it afterwards, so only
+// the first request to a host pays for resolving, connecting and the TLS
+// handshake. At most max_idle sessions per origin are kept.
+// This is a thread-safe class.
+class SessionPool {
+public:
+    explicit SessionPool(size_t max_idle = 8);
+
+    SessionPool(const SessionPool &) = delete;
+    SessionPool &operator=(const SessionPool &) = delete;
+
+    cpr::Response get(const std::string &url, const cpr::Header &header);
+    cpr::Response put(const std::string &url, const std::string &body, const cpr::Header &header);
+    cpr::Response post(const std::string &url, const std::string &body, const cpr::Header &header);
+
+    // Opens connections sessions to each base url in parallel with a HEAD
+    // request, then times a second request on one open connection of each.
+    // Any HTTP status counts: only the connection matters.
+    WarmupReport warm_up(const std::vector<std::string> &base_urls, size_t connections);
+
+private:
+    std::unique_ptr<cpr::Session> acquire(const std::string &origin);
+    void release(const std::string &origin, std::unique_ptr<cpr::Session> session);
+
+    size_t max_idle_;
+    std::mutex mutex_;
+    std::map<std::string, std::vector<std::unique_ptr<cpr::Session>>> idle_;
+};
+
+#endif // DA_SEG_SESSION_POOL_H
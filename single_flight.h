@@ -0,0 +1,95 @@
+#ifndef DA_SEG_SINGLE_FLIGHT_H
+#define DA_SEG_SINGLE_FLIGHT_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Coalesces concurrent calls with the same key: the first caller runs the work,
+// callers arriving while it is in flight wait for it and get the same result object.
+// Nothing is cached, once the call finishes the next caller with that key runs again.
+// If the work throws, the waiters fail with an error and the exception goes on
+// to the first caller.
+// This is a thread-safe class.
+template <typename T>
+class SingleFlight {
+public:
+    using Work = std::function<bool(T &result_, std::string &error_msg_)>;
+
+    // shared_ is set to true when the result came from another caller's work
+    bool run(const std::string &key, const Work &work, std::shared_ptr<const T> &result_,
+             std::string &error_msg_, bool *shared_ = nullptr)
+    {
+        std::shared_ptr<Call> call;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &slot = calls_[key];
+            if (!slot) {
+                slot = std::make_shared<Call>();
+                leader = true;
+            }
+            call = slot;
+        }
+        if (shared_) *shared_ = !leader;
+
+        if (leader) {
+            auto result = std::make_shared<T>();
+            std::string error_msg;
+            bool ok;
+            try {
+                ok = work(*result, error_msg);
+            } catch (...) {
+                finish(key, *call, false, nullptr, "in-flight call for the same key threw an exception");
+                throw;
+            }
+            finish(key, *call, ok, std::move(result), std::move(error_msg));
+        } else {
+            std::unique_lock<std::mutex> lock(call->mutex);
+            call->done_cv.wait(lock, [&] { return call->done; });
+        }
+
+        if (!call->ok) {
+            error_msg_ = call->error_msg;
+            return false;
+        }
+        result_ = call->result;
+        return true;
+    }
+
+private:
+    struct Call {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        bool done = false;
+        bool ok = false;
+        std::shared_ptr<const T> result;
+        std::string error_msg;
+    };
+
+    // Lets the next caller with key start anew and wakes the waiters
+    void finish(const std::string &key, Call &call, bool ok, std::shared_ptr<const T> result,
+                std::string error_msg)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            calls_.erase(key);
+        }
+        {
+            std::lock_guard<std::mutex> lock(call.mutex);
+            call.ok = ok;
+            call.result = std::move(result);
+            call.error_msg = std::move(error_msg);
+            call.done = true;
+        }
+        call.done_cv.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<Call>> calls_;
+};
+
+#endif // DA_SEG_SINGLE_FLIGHT_H
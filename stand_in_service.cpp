@@ -0,0 +1,269 @@
+// Local stand-in for the segmentation service and the file server, for load
+// tests of the client (see --replay in seg.cpp). Build seg with SERVER_URL and
+// FILE_SERVER_URL both set to http://127.0.0.1:PORT.
+//
+// Jobs do no work. A job completes duration_ms after it is submitted, read
+// from a "duration_ms=N" tag in the first 80 bytes of its uploaded mesh (0 if
+// there is none). Its result mesh has the size and the header of the uploaded
+// mesh; only those are kept, so a long replay does not pile up uploads.
+//
+// Usage: ./stand_in_service [PORT]     (default 18080)
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "rapidjson/document.h"
+
+using namespace rapidjson;
+using namespace std;
+
+namespace {
+
+struct Request {
+  string method;
+  string target; // path and query
+  map<string, string> headers; // lower-case names
+  string body;
+};
+
+struct Upload {
+  string head; // first 84 bytes: STL header and triangle count
+  size_t size = 0;
+};
+
+struct Job {
+  string urn;
+  string type;
+  chrono::steady_clock::time_point done;
+};
+
+mutex state_mutex;
+map<string, Upload> files;   // name -> uploaded mesh
+map<string, Job> jobs;       // run id -> job
+uint64_t next_id = 1;
+
+string lower(string s)
+{
+  for (auto &c : s) c = char(tolower((unsigned char)c));
+  return s;
+}
+
+bool send_all(int fd, const string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    sent += size_t(n);
+  }
+  return true;
+}
+
+// Reads one request off a keep-alive connection; buffer_ keeps bytes read past it
+bool read_request(int fd, string &buffer_, Request &request_)
+{
+  char chunk[64 * 1024];
+  size_t header_end;
+  while ((header_end = buffer_.find("\r\n\r\n")) == string::npos) {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buffer_.append(chunk, size_t(n));
+  }
+
+  istringstream head(buffer_.substr(0, header_end));
+  string line, version;
+  getline(head, line);
+  istringstream(line) >> request_.method >> request_.target >> version;
+  request_.headers.clear();
+  while (getline(head, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    size_t colon = line.find(':');
+    if (colon == string::npos) continue;
+    size_t value = line.find_first_not_of(' ', colon + 1);
+    request_.headers[lower(line.substr(0, colon))] = value == string::npos ? "" : line.substr(value);
+  }
+  buffer_.erase(0, header_end + 4);
+
+  size_t length = 0;
+  auto it = request_.headers.find("content-length");
+  if (it != request_.headers.end()) length = strtoull(it->second.c_str(), nullptr, 10);
+  it = request_.headers.find("expect");
+  if (it != request_.headers.end() && lower(it->second) == "100-continue" && buffer_.size() < length &&
+      !send_all(fd, "HTTP/1.1 100 Continue\r\n\r\n")) return false;
+
+  while (buffer_.size() < length) {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buffer_.append(chunk, size_t(n));
+  }
+  request_.body = buffer_.substr(0, length);
+  buffer_.erase(0, length);
+  return true;
+}
+
+bool respond(int fd, int status, const string &body, const string &content_type = "application/json")
+{
+  ostringstream head;
+  head << "HTTP/1.1 " << status << (status == 200 ? " OK" : " Error") << "\r\n"
+       << "Content-Type: " << content_type << "\r\n"
+       << "Content-Length: " << body.size() << "\r\n\r\n";
+  return send_all(fd, head.str()) && send_all(fd, body);
+}
+
+string query_value(const string &target, const string &key)
+{
+  size_t at = target.find(key + "=");
+  if (at == string::npos) return "";
+  at += key.size() + 1;
+  return target.substr(at, target.find('&', at) - at);
+}
+
+int duration_ms(const Upload &upload)
+{
+  string header = upload.head.substr(0, 80);
+  size_t at = header.find("duration_ms=");
+  return at == string::npos ? 0 : atoi(header.c_str() + at + 12);
+}
+
+// Routes one request. Returns false when the connection should be closed.
+bool handle(int fd, const Request &request)
+{
+  const string &target = request.target;
+  string path = target.substr(0, target.find('?'));
+
+  // file server: GET /scratch/APIClient/<user>/upload_url?postfix=<type>
+  if (request.method == "GET" && path.rfind("/scratch/", 0) == 0 && path.size() > 11 &&
+      path.compare(path.size() - 11, 11, "/upload_url") == 0) {
+    string user_dir = path.substr(9, path.size() - 9 - 11);
+    string host = request.headers.count("host") ? request.headers.at("host") : "127.0.0.1";
+    string postfix = query_value(target, "postfix");
+    lock_guard<mutex> lock(state_mutex);
+    string name = "upload-" + to_string(next_id++) + "." + (postfix.empty() ? "stl" : postfix);
+    return respond(fd, 200, "\"http://" + host + "/upload/" + user_dir + "/" + name + "?signature=0\"");
+  }
+  // file server: PUT /upload/APIClient/<user>/<name>
+  if (request.method == "PUT" && path.rfind("/upload/", 0) == 0) {
+    lock_guard<mutex> lock(state_mutex);
+    files[path.substr(path.rfind('/') + 1)] = {request.body.substr(0, 84), request.body.size()};
+    return respond(fd, 200, "");
+  }
+  // file server: GET /file/download?urn=<urn>; the file name is the last urn field
+  if (request.method == "GET" && path == "/file/download") {
+    string urn = query_value(target, "urn");
+    lock_guard<mutex> lock(state_mutex);
+    auto it = files.find(urn.substr(urn.rfind(':') + 1));
+    if (it == files.end()) return respond(fd, 404, "");
+    string data = it->second.head;
+    data.resize(it->second.size, '\0');
+    return respond(fd, 200, data, "application/octet-stream");
+  }
+
+  // service: POST /run
+  if (request.method == "POST" && path == "/run") {
+    Document body;
+    body.Parse(request.body.c_str());
+    if (body.HasParseError() || !body.IsObject() || !body.HasMember("input_data") || !body["input_data"].IsObject() ||
+        !body["input_data"].HasMember("mesh") || !body["input_data"]["mesh"].IsObject())
+      return respond(fd, 400, "");
+    const Value &mesh = body["input_data"]["mesh"];
+    if (!mesh.HasMember("data") || !mesh["data"].IsString() || (mesh.HasMember("type") && !mesh["type"].IsString()))
+      return respond(fd, 400, "");
+    Job job;
+    job.urn = mesh["data"].GetString();
+    job.type = mesh.HasMember("type") ? mesh["type"].GetString() : "stl";
+
+    lock_guard<mutex> lock(state_mutex);
+    auto it = files.find(job.urn.substr(job.urn.rfind(':') + 1));
+    int ms = it == files.end() ? 0 : duration_ms(it->second);
+    job.done = chrono::steady_clock::now() + chrono::milliseconds(ms);
+    string run_id = "run-" + to_string(next_id++);
+    jobs[run_id] = job;
+    return respond(fd, 200, "{\"run_id\":\"" + run_id + "\"}");
+  }
+  // service: GET /run/<id>
+  if (request.method == "GET" && path.rfind("/run/", 0) == 0) {
+    lock_guard<mutex> lock(state_mutex);
+    auto it = jobs.find(path.substr(5));
+    if (it == jobs.end()) return respond(fd, 404, "");
+    bool completed = chrono::steady_clock::now() >= it->second.done;
+    return respond(fd, 200, string("{\"completed\":") + (completed ? "true" : "false") +
+                                ",\"failed\":false,\"reason_public\":\"\"}");
+  }
+  // service: GET /data/<id>. One label per vertex of a closed mesh: half the triangle count.
+  if (request.method == "GET" && path.rfind("/data/", 0) == 0) {
+    lock_guard<mutex> lock(state_mutex);
+    auto it = jobs.find(path.substr(6));
+    if (it == jobs.end()) return respond(fd, 404, "");
+    auto file = files.find(it->second.urn.substr(it->second.urn.rfind(':') + 1));
+    size_t labels = file == files.end() || file->second.size < 84 ? 0 : (file->second.size - 84) / 50 / 2;
+    string body = "{\"mesh\":{\"type\":\"" + it->second.type + "\",\"data\":\"" + it->second.urn +
+                  "\"},\"seg_labels\":[";
+    for (size_t i = 0; i < labels; ++i) body += i ? ",0" : "0";
+    body += "]}";
+    return respond(fd, 200, body);
+  }
+
+  respond(fd, 404, "");
+  return false;
+}
+
+void serve(int fd)
+{
+  string buffer;
+  Request request;
+  while (read_request(fd, buffer, request)) {
+    if (!handle(fd, request)) break;
+    auto it = request.headers.find("connection");
+    if (it != request.headers.end() && lower(it->second) == "close") break;
+  }
+  close(fd);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]){
+    int port = argc > 1 ? atoi(argv[1]) : 18080;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(uint16_t(port));
+    if (listener < 0 || ::bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 256) != 0) {
+        cout << "could not listen on port " << port << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    cout << "stand-in service listening on http://127.0.0.1:" << port << endl;
+
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            cout << "accept failed: " << strerror(errno) << endl;
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        thread(serve, fd).detach();
+    }
+}
@@ -0,0 +1,134 @@
+#include "tooth_split.h"
+#include "parallel.h"
+#include "ply.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+bool split_by_label(const IndexedMesh &mesh, const vector<int> &vertex_labels,
+                    vector<MeshPart> &parts_, string &error_msg_, unsigned threads)
+{
+    if (vertex_labels.size() != mesh.vertices.size()) {
+        error_msg_ = "label count " + to_string(vertex_labels.size()) +
+                     " does not match vertex count " + to_string(mesh.vertices.size());
+        return false;
+    }
+
+    // dense ids for the labels in use
+    vector<int> labels(vertex_labels);
+    sort(labels.begin(), labels.end());
+    labels.erase(unique(labels.begin(), labels.end()), labels.end());
+    size_t label_count = labels.size();
+
+    size_t triangles = mesh.triangle_count();
+    const uint32_t *idx = mesh.indices.data();
+
+    // Step 1. one pass over the triangles: face label and per-range histogram
+    vector<uint32_t> face_part(triangles);
+    unsigned chunks = parallel_chunks(triangles, threads);
+    vector<vector<size_t>> counts(chunks, vector<size_t>(label_count, 0));
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned chunk) {
+        auto &count = counts[chunk];
+        for (size_t t = begin; t < end; ++t) {
+            int label = majority_label(vertex_labels[idx[t * 3]], vertex_labels[idx[t * 3 + 1]],
+                                       vertex_labels[idx[t * 3 + 2]]);
+            uint32_t part = uint32_t(lower_bound(labels.begin(), labels.end(), label) - labels.begin());
+            face_part[t] = part;
+            ++count[part];
+        }
+    }, threads);
+
+    // Step 2. bucket triangles by part, keeping their order inside each part
+    vector<size_t> part_start(label_count + 1, 0);
+    for (size_t p = 0; p < label_count; ++p)
+        for (unsigned c = 0; c < chunks; ++c) part_start[p + 1] += counts[c][p];
+    for (size_t p = 0; p < label_count; ++p) part_start[p + 1] += part_start[p];
+
+    vector<vector<size_t>> cursor(chunks, vector<size_t>(label_count));
+    for (size_t p = 0; p < label_count; ++p) {
+        size_t at = part_start[p];
+        for (unsigned c = 0; c < chunks; ++c) {
+            cursor[c][p] = at;
+            at += counts[c][p];
+        }
+    }
+
+    vector<uint32_t> bucketed(triangles);
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned chunk) {
+        auto &at = cursor[chunk];
+        for (size_t t = begin; t < end; ++t) bucketed[at[face_part[t]]++] = uint32_t(t);
+    }, threads);
+
+    // Step 3. each part remaps its vertex indices on its own
+    parts_.assign(label_count, MeshPart());
+    parallel_for(label_count, [&](size_t begin, size_t end, unsigned) {
+        vector<uint32_t> local(mesh.vertices.size(), UINT32_MAX), touched;
+        for (size_t p = begin; p < end; ++p) {
+            MeshPart &part = parts_[p];
+            part.label = labels[p];
+            IndexedMesh &out = part.mesh;
+            out.indices.reserve((part_start[p + 1] - part_start[p]) * 3);
+
+            for (size_t k = part_start[p]; k < part_start[p + 1]; ++k) {
+                size_t t = bucketed[k];
+                for (int c = 0; c < 3; ++c) {
+                    uint32_t v = idx[t * 3 + c];
+                    if (local[v] == UINT32_MAX) {
+                        local[v] = uint32_t(out.vertices.size());
+                        touched.push_back(v);
+                        out.vertices.x.push_back(mesh.vertices.x[v]);
+                        out.vertices.y.push_back(mesh.vertices.y[v]);
+                        out.vertices.z.push_back(mesh.vertices.z[v]);
+                    }
+                    out.indices.push_back(local[v]);
+                }
+            }
+            // reset only the entries this part touched
+            for (uint32_t v : touched) local[v] = UINT32_MAX;
+            touched.clear();
+        }
+    }, threads, 1);
+
+    // labels on vertices only (no triangle won the vote) give empty parts
+    parts_.erase(remove_if(parts_.begin(), parts_.end(),
+                           [](const MeshPart &part) { return part.mesh.indices.empty(); }),
+                 parts_.end());
+    return true;
+}
+
+string part_file_name(int label, const string &extension)
+{
+    return (label == 0 ? string("gingiva") : "tooth_" + to_string(label)) + "." + extension;
+}
+
+bool write_parts(const vector<MeshPart> &parts, const string &dir, const string &mesh_type, string &error_msg_,
+                 unsigned threads)
+{
+    if (!fs::is_directory(dir)) fs::create_directories(dir);
+
+    // parts are written in parallel, so each one is encoded on a single thread
+    mutex error_mutex;
+    bool ok = true;
+    parallel_for(parts.size(), [&](size_t begin, size_t end, unsigned) {
+        string data;
+        for (size_t p = begin; p < end; ++p) {
+            if (mesh_type == "ply") write_ply(parts[p].mesh, data, 1);
+            else write_stl(parts[p].mesh, data, 1);
+            fs::path path = fs::path(dir) / part_file_name(parts[p].label, mesh_type);
+            ofstream ofs(path, ofstream::out | ofstream::binary);
+            ofs.write(data.data(), data.size());
+            if (!ofs) {
+                lock_guard<mutex> lock(error_mutex);
+                error_msg_ = "could not write " + path.string();
+                ok = false;
+            }
+        }
+    }, threads, 1);
+    return ok;
+}
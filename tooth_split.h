@@ -0,0 +1,27 @@
+#ifndef DA_SEG_TOOTH_SPLIT_H
+#define DA_SEG_TOOTH_SPLIT_H
+
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+struct MeshPart {
+    int label;
+    IndexedMesh mesh;
+};
+
+// Splits a segmented mesh into one part per label, triangles going to the
+// majority label of their vertices. Parts are sorted by label and only hold
+// the vertices their triangles use.
+bool split_by_label(const IndexedMesh &mesh, const std::vector<int> &vertex_labels,
+                    std::vector<MeshPart> &parts_, std::string &error_msg_, unsigned threads = 0);
+
+// File name of a part: gingiva.<extension> for label 0, tooth_<label>.<extension> otherwise
+std::string part_file_name(int label, const std::string &extension);
+
+// Writes every part into dir as binary "stl" or "ply", several files at once
+bool write_parts(const std::vector<MeshPart> &parts, const std::string &dir, const std::string &mesh_type,
+                 std::string &error_msg_, unsigned threads = 0);
+
+#endif // DA_SEG_TOOTH_SPLIT_H
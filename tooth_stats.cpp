@@ -0,0 +1,249 @@
+#include "tooth_stats.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+using namespace std;
+
+namespace {
+
+// Triangles whose per-face values are computed together before they are
+// added to their labels; the per-face loop then has no branches
+const size_t kBlock = 256;
+
+// Sums of one label within one chunk. second[] is the surface integral of
+// x x^T, upper triangle: xx, xy, xz, yy, yz, zz.
+struct Accumulator {
+  size_t triangles = 0;
+  double area = 0;
+  double first[3] = {0, 0, 0};
+  double second[6] = {0, 0, 0, 0, 0, 0};
+  float min[3] = {numeric_limits<float>::max(), numeric_limits<float>::max(), numeric_limits<float>::max()};
+  float max[3] = {-numeric_limits<float>::max(), -numeric_limits<float>::max(), -numeric_limits<float>::max()};
+
+  void merge(const Accumulator &o)
+  {
+    triangles += o.triangles;
+    area += o.area;
+    for (int k = 0; k < 3; ++k) {
+      first[k] += o.first[k];
+      min[k] = std::min(min[k], o.min[k]);
+      max[k] = std::max(max[k], o.max[k]);
+    }
+    for (int k = 0; k < 6; ++k) second[k] += o.second[k];
+  }
+};
+
+// Eigen decomposition of a symmetric 3x3 matrix by cyclic Jacobi rotations.
+// Eigenvectors end up in the columns of v.
+void symmetric_eigen(double a[3][3], double values[3], double v[3][3])
+{
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j) v[i][j] = i == j;
+
+  for (int sweep = 0; sweep < 50; ++sweep) {
+    double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+    if (off < 1e-30) break;
+    for (int p = 0; p < 2; ++p) {
+      for (int q = p + 1; q < 3; ++q) {
+        if (a[p][q] == 0) continue;
+        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+        double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+        double c = 1 / sqrt(t * t + 1), s = t * c;
+        for (int k = 0; k < 3; ++k) {
+          double akp = a[k][p], akq = a[k][q];
+          a[k][p] = c * akp - s * akq;
+          a[k][q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < 3; ++k) {
+          double apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c * apk - s * aqk;
+          a[q][k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < 3; ++k) {
+          double vkp = v[k][p], vkq = v[k][q];
+          v[k][p] = c * vkp - s * vkq;
+          v[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < 3; ++i) values[i] = a[i][i];
+}
+
+void finish(const Accumulator &acc, ToothStats &s)
+{
+  s.triangles = acc.triangles;
+  s.area = acc.area;
+  for (int k = 0; k < 3; ++k) {
+    s.min[k] = acc.min[k];
+    s.max[k] = acc.max[k];
+  }
+  if (acc.area <= 0) return;
+
+  for (int k = 0; k < 3; ++k) s.centroid[k] = acc.first[k] / acc.area;
+  const int at[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+  double cov[3][3], values[3], vectors[3][3];
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j) cov[i][j] = acc.second[at[i][j]] / acc.area - s.centroid[i] * s.centroid[j];
+  symmetric_eigen(cov, values, vectors);
+
+  int order[3] = {0, 1, 2};
+  sort(order, order + 3, [&](int a, int b) { return values[a] > values[b]; });
+  for (int r = 0; r < 3; ++r) {
+    int c = order[r];
+    s.variances[r] = std::max(values[c], 0.0);
+    // sign convention: the largest component of each axis is positive
+    int largest = 0;
+    for (int k = 1; k < 3; ++k)
+      if (fabs(vectors[k][c]) > fabs(vectors[largest][c])) largest = k;
+    double sign = vectors[largest][c] < 0 ? -1 : 1;
+    for (int k = 0; k < 3; ++k) s.axes[r][k] = sign * vectors[k][c];
+  }
+}
+
+} // namespace
+
+bool tooth_stats(const IndexedMesh &mesh, const vector<int> &vertex_labels,
+                 vector<ToothStats> &stats_, string &error_msg_, unsigned threads)
+{
+    if (vertex_labels.size() != mesh.vertices.size()) {
+        error_msg_ = "label count " + to_string(vertex_labels.size()) +
+                     " does not match vertex count " + to_string(mesh.vertices.size());
+        return false;
+    }
+
+    // dense ids for the labels in use
+    vector<int> labels(vertex_labels);
+    sort(labels.begin(), labels.end());
+    labels.erase(unique(labels.begin(), labels.end()), labels.end());
+    size_t label_count = labels.size();
+
+    const Vertices &v = mesh.vertices;
+    const uint32_t *idx = mesh.indices.data();
+    size_t triangles = mesh.triangle_count();
+
+    // Step 1. per-chunk sums, one pass over the triangles
+    unsigned chunks = parallel_chunks(triangles, threads);
+    vector<vector<Accumulator>> partial(chunks, vector<Accumulator>(label_count));
+    parallel_for(triangles, [&](size_t begin, size_t end, unsigned chunk) {
+        auto &acc = partial[chunk];
+        double area[kBlock], first[3][kBlock], second[6][kBlock];
+        float lo[3][kBlock], hi[3][kBlock];
+        uint32_t part[kBlock];
+
+        for (size_t block = begin; block < end; block += kBlock) {
+            size_t n = std::min(kBlock, end - block);
+
+            // per-face values. The surface integral of x x^T over a triangle with
+            // corners a, b, c, centroid m and area A is A / 12 (9 m m^T + a a^T + b b^T + c c^T).
+            for (size_t i = 0; i < n; ++i) {
+                const uint32_t *f = idx + (block + i) * 3;
+                double p[3][3];
+                for (int c = 0; c < 3; ++c) {
+                    p[c][0] = v.x[f[c]];
+                    p[c][1] = v.y[f[c]];
+                    p[c][2] = v.z[f[c]];
+                }
+                double ux = p[1][0] - p[0][0], uy = p[1][1] - p[0][1], uz = p[1][2] - p[0][2];
+                double wx = p[2][0] - p[0][0], wy = p[2][1] - p[0][1], wz = p[2][2] - p[0][2];
+                double nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+                double a = 0.5 * sqrt(nx * nx + ny * ny + nz * nz);
+                double m[3];
+                for (int k = 0; k < 3; ++k) {
+                    m[k] = (p[0][k] + p[1][k] + p[2][k]) / 3;
+                    lo[k][i] = float(std::min(p[0][k], std::min(p[1][k], p[2][k])));
+                    hi[k][i] = float(std::max(p[0][k], std::max(p[1][k], p[2][k])));
+                    first[k][i] = a * m[k];
+                }
+                const int row[6] = {0, 0, 0, 1, 1, 2}, col[6] = {0, 1, 2, 1, 2, 2};
+                for (int k = 0; k < 6; ++k) {
+                    int r = row[k], c = col[k];
+                    second[k][i] = a / 12 * (9 * m[r] * m[c] + p[0][r] * p[0][c] + p[1][r] * p[1][c] + p[2][r] * p[2][c]);
+                }
+                area[i] = a;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                const uint32_t *f = idx + (block + i) * 3;
+                int label = majority_label(vertex_labels[f[0]], vertex_labels[f[1]], vertex_labels[f[2]]);
+                part[i] = uint32_t(lower_bound(labels.begin(), labels.end(), label) - labels.begin());
+            }
+
+            // scatter into the labels
+            for (size_t i = 0; i < n; ++i) {
+                Accumulator &a = acc[part[i]];
+                ++a.triangles;
+                a.area += area[i];
+                for (int k = 0; k < 3; ++k) {
+                    a.first[k] += first[k][i];
+                    a.min[k] = std::min(a.min[k], lo[k][i]);
+                    a.max[k] = std::max(a.max[k], hi[k][i]);
+                }
+                for (int k = 0; k < 6; ++k) a.second[k] += second[k][i];
+            }
+        }
+    }, threads);
+
+    // Step 2. merge in chunk order, so the result does not depend on timing
+    stats_.clear();
+    for (size_t l = 0; l < label_count; ++l) {
+        Accumulator total;
+        for (unsigned c = 0; c < chunks; ++c) total.merge(partial[c][l]);
+        if (total.triangles == 0) continue; // label only on vertices, no triangle has it
+        ToothStats s;
+        s.label = labels[l];
+        finish(total, s);
+        stats_.push_back(s);
+    }
+    return true;
+}
+
+string tooth_stats_json(const vector<ToothStats> &stats)
+{
+    using namespace rapidjson;
+    StringBuffer buffer;
+    Writer<StringBuffer> writer(buffer);
+
+    auto write_array = [&](const char *key, const auto *values) {
+        writer.Key(key);
+        writer.StartArray();
+        for (int k = 0; k < 3; ++k) writer.Double(values[k]);
+        writer.EndArray();
+    };
+
+    writer.StartObject();
+    writer.Key("teeth");
+    writer.StartArray();
+    for (const auto &s : stats) {
+        writer.StartObject();
+        writer.Key("label");
+        writer.Int(s.label);
+        writer.Key("triangles");
+        writer.Uint64(s.triangles);
+        writer.Key("area");
+        writer.Double(s.area);
+        write_array("centroid", s.centroid);
+        write_array("min", s.min);
+        write_array("max", s.max);
+        writer.Key("axes");
+        writer.StartArray();
+        for (const auto &axis : s.axes) {
+            writer.StartArray();
+            for (double c : axis) writer.Double(c);
+            writer.EndArray();
+        }
+        writer.EndArray();
+        write_array("variances", s.variances);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return string(buffer.GetString(), buffer.GetSize());
+}
@@ -0,0 +1,33 @@
+#ifndef DA_SEG_TOOTH_STATS_H
+#define DA_SEG_TOOTH_STATS_H
+
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+// Geometry of the triangles of one label. Triangles go to the majority label
+// of their vertices, as in split_by_label.
+struct ToothStats {
+    int label = 0;
+    size_t triangles = 0;
+    double area = 0;
+    double centroid[3] = {0, 0, 0}; // area-weighted, over the surface
+    float min[3] = {0, 0, 0};
+    float max[3] = {0, 0, 0};
+    // principal axes of the surface, unit vectors sorted by decreasing
+    // variance along them
+    double axes[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    double variances[3] = {0, 0, 0};
+};
+
+// All statistics of all labels in one parallel pass over the triangles.
+// Sorted by label.
+bool tooth_stats(const IndexedMesh &mesh, const std::vector<int> &vertex_labels,
+                 std::vector<ToothStats> &stats_, std::string &error_msg_, unsigned threads = 0);
+
+// {"teeth": [{"label": .., "triangles": .., "area": .., "centroid": [x, y, z],
+//             "min": [..], "max": [..], "axes": [[..], [..], [..]], "variances": [..]}, ..]}
+std::string tooth_stats_json(const std::vector<ToothStats> &stats);
+
+#endif // DA_SEG_TOOTH_STATS_H